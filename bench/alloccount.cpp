@@ -0,0 +1,88 @@
+#include "alloccount.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+
+static std::atomic<uint64_t> g_Allocations(0);
+static std::atomic<uint64_t> g_Bytes(0);
+static std::atomic<int64_t> g_Live(0);
+static std::atomic<int64_t> g_Peak(0);
+
+static void *CountedAlloc(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+	if (!p)
+	{
+		throw std::bad_alloc();
+	}
+
+	// 用实际分配的大小, 释放时才能对上
+	int64_t usable = (int64_t)malloc_usable_size(p);
+	g_Allocations++;
+	g_Bytes += usable;
+
+	int64_t live = (g_Live += usable);
+	int64_t peak = g_Peak.load();
+	while (live > peak && !g_Peak.compare_exchange_weak(peak, live))
+	{
+	}
+
+	return p;
+}
+
+static void CountedFree(void *p)
+{
+	if (!p)
+	{
+		return;
+	}
+
+	g_Live -= (int64_t)malloc_usable_size(p);
+	free(p);
+}
+
+void *operator new(size_t size)
+{
+	return CountedAlloc(size);
+}
+
+void *operator new[](size_t size)
+{
+	return CountedAlloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete(void *p, size_t size) noexcept
+{
+	CountedFree(p);
+}
+
+void operator delete[](void *p, size_t size) noexcept
+{
+	CountedFree(p);
+}
+
+AllocSnapshot AllocCounter::Get()
+{
+	AllocSnapshot snapshot;
+	snapshot.allocations = g_Allocations.load();
+	snapshot.bytes = g_Bytes.load();
+	snapshot.live = g_Live.load();
+	snapshot.peak = g_Peak.load();
+	return snapshot;
+}
+
+void AllocCounter::ResetPeak()
+{
+	g_Peak = g_Live.load();
+}
@@ -0,0 +1,35 @@
+#ifndef _INCLUDE_MODEGROUP_BENCH_ALLOCCOUNT_H_
+#define _INCLUDE_MODEGROUP_BENCH_ALLOCCOUNT_H_
+
+/**
+ * @file alloccount.h
+ * @brief Heap accounting for the benchmark.
+ *
+ * alloccount.cpp replaces the global operator new and delete of the
+ * benchmark binary, so every C++ allocation, including those inside the
+ * extension and the standard library, is counted.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct AllocSnapshot
+{
+	uint64_t allocations; // operator new calls so far
+	uint64_t bytes;       // bytes handed out so far
+	int64_t live;         // bytes currently allocated
+	int64_t peak;         // highest value of live since the last ResetPeak()
+};
+
+class AllocCounter
+{
+public:
+	static AllocSnapshot Get();
+
+	/**
+	 * Starts a new peak measurement at the current live size.
+	 */
+	static void ResetPeak();
+};
+
+#endif // _INCLUDE_MODEGROUP_BENCH_ALLOCCOUNT_H_
@@ -0,0 +1,541 @@
+/**
+ * @file bench.cpp
+ * @brief Host-side benchmark of mode group switches.
+ *
+ * Builds a throwaway SourceMod tree with two synthetic groups, then switches
+ * between them with the real extension code running against the fakes in
+ * fakes.cpp. Every plugin count produces one JSON object per line on stdout.
+ *
+ *   modegroup_bench [switch] [--plugins 10,100,500,2000] [--cvars 1000] [--switches 20]
+ *                   [--mode immediate|incremental] [--budget-ms 2] [--tick-ms 0]
+ *                   [--load-us 0] [--unload-us 0] [--command-us 0] [--line-us 0]
+ *                   [--plugin-kb 16] [--burst 0] [--suspend] [--keep] [--verbose]
+ *
+ * With --burst N every switch is made of N requests through the switch
+ * queue, alternating between the two groups and ending on the target, as if
+ * several plugins asked for a switch in the same frame. Without it the
+ * switch is started directly. --suspend gives both groups suspend_on_leave,
+ * so after the first round trip their plugins are paused and resumed
+ * instead of unloaded and loaded.
+ *
+ *   modegroup_bench parse ...     see parsebench.cpp
+ *   modegroup_bench generate ...  see parsebench.cpp
+ *   modegroup_bench check ...     see check.cpp
+ */
+
+#include "bench.h"
+#include "fakes.h"
+#include "extension.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SMX_HEADER_SIZE		24
+
+struct BenchOptions
+{
+	BenchOptions() : cvars(1000), switches(20), incremental(false), budget_ms(2.0f),
+		tick_ms(0.0f), plugin_kb(16), burst(0), suspend(false), keep(false)
+	{
+	}
+
+	std::vector<size_t> plugins;
+	size_t cvars;
+	size_t switches;
+	bool incremental;
+	float budget_ms;
+	float tick_ms; // frame interval for incremental switches, 0 runs frames back to back
+	size_t plugin_kb;
+	size_t burst; // switch requests per switch, 0 starts the switch directly
+	bool suspend; // groups have suspend_on_leave
+	bool keep;
+};
+
+struct Sample
+{
+	SwitchStats stats;
+	double host_ms; // measured around the switch by the benchmark, frames included
+	size_t frames;
+};
+
+static void WriteLE16(unsigned char *p, unsigned int v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void WriteLE32(unsigned char *p, unsigned int v)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		p[i] = (unsigned char)(v >> (i * 8));
+	}
+}
+
+static bool WritePlugin(const std::string &path, size_t size)
+{
+	std::vector<unsigned char> data(size < SMX_HEADER_SIZE ? SMX_HEADER_SIZE : size, 0);
+	WriteLE32(&data[0], 0x53504646); // magic
+	WriteLE16(&data[4], 0x0102);     // version
+	data[6] = 0;                     // compression
+	WriteLE32(&data[7], (unsigned int)data.size());  // disksize
+	WriteLE32(&data[11], (unsigned int)data.size()); // imagesize
+	data[15] = 1;                    // sections
+	WriteLE32(&data[16], SMX_HEADER_SIZE); // stringtab
+	WriteLE32(&data[20], SMX_HEADER_SIZE); // dataoffs
+
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (!fp)
+	{
+		return false;
+	}
+	bool ok = fwrite(&data[0], 1, data.size(), fp) == data.size();
+	return (fclose(fp) == 0) && ok;
+}
+
+bool MakeDir(const std::string &path)
+{
+	return mkdir(path.c_str(), 0755) == 0;
+}
+
+static int RemoveEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+void RemoveTree(const char *path)
+{
+	nftw(path, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+bool WriteTextFile(const std::string &path, const std::string &text)
+{
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (!fp)
+	{
+		return false;
+	}
+	bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+	return (fclose(fp) == 0) && ok;
+}
+
+static void AppendGroup(std::string &cfg, const char *name, const std::string &dir,
+	const std::vector<std::string> &shared, size_t cvars, bool suspend)
+{
+	char line[256];
+	cfg += "\t\"";
+	cfg += name;
+	cfg += "\"\n\t{\n\t\t\"plugin_directory\"\t\"" + dir + "\"\n\t\t\"use_sm_cvar\"\t\"0\"\n";
+	if (suspend)
+	{
+		cfg += "\t\t\"suspend_on_leave\"\t\"1\"\n";
+	}
+
+	cfg += "\t\t\"load_plugins\"\n\t\t{\n";
+	for (size_t i = 0; i < shared.size(); i++)
+	{
+		ke::SafeSprintf(line, sizeof(line), "\t\t\t\"%zu\"\t\"%s\"\n", i, shared[i].c_str());
+		cfg += line;
+	}
+	cfg += "\t\t}\n";
+
+	cfg += "\t\t\"cvars\"\n\t\t{\n";
+	for (size_t i = 0; i < cvars; i++)
+	{
+		ke::SafeSprintf(line, sizeof(line), "\t\t\t\"bench_cvar_%zu\"\t\"%s_%zu\"\n", i, name, i);
+		cfg += line;
+	}
+	cfg += "\t\t}\n";
+
+	cfg += "\t\t\"commands\"\n\t\t{\n\t\t\t\"echo\"\t\"";
+	cfg += name;
+	cfg += "\"\n\t\t}\n\t}\n";
+}
+
+/**
+ * Creates root/{configs,data,game,plugins} with groups bench_a and bench_b.
+ * Each group has its own plugin directory and both load a quarter of the
+ * plugins from a shared directory, so switches exercise unloads, loads and
+ * plugins that stay running.
+ */
+static bool BuildTree(const std::string &root, const BenchOptions &options, size_t plugins)
+{
+	char dirName[64];
+	ke::SafeSprintf(dirName, sizeof(dirName), "bench_%zu", plugins);
+	std::string base = root + "/plugins/" + dirName;
+
+	if (!MakeDir(root + "/configs") || !MakeDir(root + "/data") || !MakeDir(root + "/game")
+		|| !MakeDir(root + "/plugins") || !MakeDir(base) || !MakeDir(base + "/a")
+		|| !MakeDir(base + "/b") || !MakeDir(base + "/shared"))
+	{
+		return false;
+	}
+
+	size_t sharedCount = plugins / 4;
+	size_t ownCount = plugins - sharedCount;
+	size_t size = options.plugin_kb * 1024;
+	char file[64];
+
+	std::vector<std::string> shared;
+	for (size_t i = 0; i < sharedCount; i++)
+	{
+		ke::SafeSprintf(file, sizeof(file), "shared/s%zu.smx", i);
+		if (!WritePlugin(base + "/" + file, size))
+		{
+			return false;
+		}
+		shared.push_back(std::string(dirName) + "/" + file);
+	}
+
+	for (size_t i = 0; i < ownCount; i++)
+	{
+		ke::SafeSprintf(file, sizeof(file), "/a/a%zu.smx", i);
+		if (!WritePlugin(base + file, size))
+		{
+			return false;
+		}
+		ke::SafeSprintf(file, sizeof(file), "/b/b%zu.smx", i);
+		if (!WritePlugin(base + file, size))
+		{
+			return false;
+		}
+	}
+
+	std::string cfg = "\"Settings\"\n{\n";
+	cfg += options.incremental ? "\t\"switch_mode\"\t\"incremental\"\n" : "\t\"switch_mode\"\t\"immediate\"\n";
+	char budget[64];
+	ke::SafeSprintf(budget, sizeof(budget), "\t\"frame_budget_ms\"\t\"%g\"\n", options.budget_ms);
+	cfg += budget;
+	cfg += "}\n\"ModeGroups\"\n{\n";
+	AppendGroup(cfg, "bench_a", std::string(dirName) + "/a", shared, options.cvars, options.suspend);
+	AppendGroup(cfg, "bench_b", std::string(dirName) + "/b", shared, options.cvars, options.suspend);
+	cfg += "}\n";
+
+	return WriteTextFile(root + "/configs/modegroup.cfg", cfg);
+}
+
+static bool RunSwitch(const char *group, const char *other, const BenchOptions &options, Sample &sample)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (options.burst == 0)
+	{
+		if (!g_ModeGroupExtension.SwitchModeGroup(group))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		// 最后一个请求是目标分组, 前面的都会被它替换
+		for (size_t i = options.burst; i-- > 0; )
+		{
+			if (g_ModeGroupExtension.RequestSwitch(i % 2 == 0 ? group : other) == 0)
+			{
+				return false;
+			}
+		}
+	}
+
+	// incremental 模式下一直跑帧直到切换完成
+	sample.frames = 0;
+	while (strcmp(g_ModeGroupExtension.GetCurrentModeGroupName(), group) != 0)
+	{
+		if (sample.frames >= 10000000)
+		{
+			return false;
+		}
+		std::chrono::steady_clock::time_point frame = std::chrono::steady_clock::now();
+		g_BenchHost.RunFrame();
+		sample.frames++;
+
+		if (options.tick_ms > 0.0f)
+		{
+			std::chrono::duration<double, std::micro> used = std::chrono::steady_clock::now() - frame;
+			double left = options.tick_ms * 1000.0 - used.count();
+			if (left > 0.0)
+			{
+				usleep((useconds_t)left);
+			}
+		}
+	}
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	sample.host_ms = elapsed.count();
+
+	const SwitchStats *stats = g_ModeGroupExtension.GetSwitchStats(0);
+	if (!stats || stats->to != group)
+	{
+		return false;
+	}
+	sample.stats = *stats;
+
+	return true;
+}
+
+double Percentile(std::vector<double> values, double percent)
+{
+	if (values.empty())
+	{
+		return 0.0;
+	}
+
+	std::sort(values.begin(), values.end());
+	size_t rank = (size_t)((percent / 100.0) * (values.size() - 1) + 0.5);
+	return values[rank];
+}
+
+void PrintDistribution(const char *name, const std::vector<double> &values)
+{
+	printf(",\"%s\":{\"min\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"max\":%.3f}", name,
+		Percentile(values, 0.0), Percentile(values, 50.0), Percentile(values, 90.0), Percentile(values, 100.0));
+}
+
+static bool RunBenchmark(const BenchOptions &options, size_t plugins)
+{
+	char root[] = "/tmp/modegroup-bench-XXXXXX";
+	if (!mkdtemp(root))
+	{
+		fprintf(stderr, "E Could not create a temporary directory\n");
+		return false;
+	}
+
+	bool ok = BuildTree(root, options, plugins);
+	if (!ok)
+	{
+		fprintf(stderr, "E Could not build the benchmark tree in %s\n", root);
+	}
+
+	std::vector<Sample> samples;
+	Sample cold;
+	char error[256];
+
+	g_BenchHost.SetRoot(root);
+	if (ok && !g_ModeGroupExtension.SDK_OnLoad(error, sizeof(error), false))
+	{
+		fprintf(stderr, "E %s\n", error);
+		ok = false;
+	}
+	else if (ok)
+	{
+		ok = RunSwitch("bench_a", "bench_b", options, cold);
+		for (size_t i = 0; ok && i < options.switches; i++)
+		{
+			Sample sample;
+			ok = RunSwitch(i % 2 == 0 ? "bench_b" : "bench_a", i % 2 == 0 ? "bench_a" : "bench_b", options, sample);
+			samples.push_back(sample);
+		}
+		if (!ok)
+		{
+			fprintf(stderr, "E A switch did not complete\n");
+		}
+
+		g_ModeGroupExtension.SDK_OnUnload();
+	}
+
+	if (ok)
+	{
+		std::vector<double> total, host, frames, loaded, unloaded, resumed;
+		std::vector<double> phases[SwitchStat_Count];
+		for (size_t i = 0; i < samples.size(); i++)
+		{
+			total.push_back(samples[i].stats.total_ms);
+			host.push_back(samples[i].host_ms);
+			frames.push_back((double)samples[i].frames);
+			loaded.push_back((double)samples[i].stats.loaded);
+			unloaded.push_back((double)samples[i].stats.unloaded);
+			resumed.push_back((double)samples[i].stats.resumed);
+			for (int j = 0; j < SwitchStat_Count; j++)
+			{
+				phases[j].push_back(samples[i].stats.phase_ms[j]);
+			}
+		}
+
+		printf("{\"bench\":\"switch\",\"plugins\":%zu,\"shared\":%zu,\"cvars\":%zu,\"mode\":\"%s\",\"switches\":%zu,\"tick_ms\":%g",
+			plugins, plugins / 4, options.cvars, options.incremental ? "incremental" : "immediate", samples.size(),
+			options.tick_ms);
+		printf(",\"load_us\":%u,\"unload_us\":%u,\"command_us\":%u,\"line_us\":%u,\"plugin_kb\":%zu,\"burst\":%zu,\"suspend\":%s",
+			g_BenchHost.costs.load_us, g_BenchHost.costs.unload_us, g_BenchHost.costs.command_us,
+			g_BenchHost.costs.line_us, options.plugin_kb, options.burst, options.suspend ? "true" : "false");
+		printf(",\"cold_ms\":%.3f", cold.stats.total_ms);
+		PrintDistribution("total_ms", total);
+		PrintDistribution("host_ms", host);
+		printf(",\"frames_p50\":%.0f,\"loaded_p50\":%.0f,\"unloaded_p50\":%.0f,\"resumed_p50\":%.0f",
+			Percentile(frames, 50.0), Percentile(loaded, 50.0), Percentile(unloaded, 50.0), Percentile(resumed, 50.0));
+		printf(",\"phase_p50_ms\":{");
+		for (int j = 0; j < SwitchStat_Count; j++)
+		{
+			printf("%s\"%s\":%.3f", j ? "," : "", SwitchStats::GetPhaseName((SwitchStatPhase)j), Percentile(phases[j], 50.0));
+		}
+		printf("}}\n");
+		fflush(stdout);
+	}
+
+	if (!options.keep)
+	{
+		RemoveTree(root);
+	}
+	else
+	{
+		fprintf(stderr, "Kept %s\n", root);
+	}
+
+	return ok;
+}
+
+void ParseList(const char *arg, std::vector<size_t> &values)
+{
+	values.clear();
+	const char *p = arg;
+	while (*p)
+	{
+		char *end;
+		unsigned long v = strtoul(p, &end, 10);
+		if (end == p)
+		{
+			break;
+		}
+		values.push_back((size_t)v);
+		p = (*end == ',') ? end + 1 : end;
+	}
+}
+
+void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: modegroup_bench [switch] [--plugins 10,100,500,2000] [--cvars 1000] [--switches 20]\n"
+		"                       [--mode immediate|incremental] [--budget-ms 2] [--tick-ms 0]\n"
+		"                       [--load-us 0] [--unload-us 0] [--command-us 0] [--line-us 0]\n"
+		"                       [--plugin-kb 16] [--burst 0] [--suspend] [--keep] [--verbose]\n"
+		"       modegroup_bench parse [--groups 10,100,1000,10000,50000] [--repeat 5] [--seed 1] [--keep]\n"
+		"       modegroup_bench generate --groups N [--seed 1] [--cvars 20] [--commands 3]\n"
+		"                       [--load-plugins 6] [--unload-plugins 2] [--lazy-parse 0]\n"
+		"                       [--output modegroup.cfg]\n"
+		"       modegroup_bench check [--groups 1000] [--seed 1]\n");
+}
+
+static int SwitchBenchMain(int argc, char **argv)
+{
+	BenchOptions options;
+	ParseList("10,100,500,2000", options.plugins);
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--keep") == 0)
+		{
+			options.keep = true;
+			continue;
+		}
+		if (strcmp(arg, "--verbose") == 0)
+		{
+			g_BenchHost.verbose = true;
+			continue;
+		}
+		if (strcmp(arg, "--suspend") == 0)
+		{
+			options.suspend = true;
+			continue;
+		}
+		if (!value)
+		{
+			PrintUsage();
+			return 1;
+		}
+		i++;
+
+		if (strcmp(arg, "--plugins") == 0)
+		{
+			ParseList(value, options.plugins);
+		}
+		else if (strcmp(arg, "--cvars") == 0)
+		{
+			options.cvars = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--switches") == 0)
+		{
+			options.switches = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--mode") == 0)
+		{
+			options.incremental = strcmp(value, "incremental") == 0;
+		}
+		else if (strcmp(arg, "--budget-ms") == 0)
+		{
+			options.budget_ms = (float)atof(value);
+		}
+		else if (strcmp(arg, "--tick-ms") == 0)
+		{
+			options.tick_ms = (float)atof(value);
+		}
+		else if (strcmp(arg, "--load-us") == 0)
+		{
+			g_BenchHost.costs.load_us = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--unload-us") == 0)
+		{
+			g_BenchHost.costs.unload_us = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--command-us") == 0)
+		{
+			g_BenchHost.costs.command_us = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--line-us") == 0)
+		{
+			g_BenchHost.costs.line_us = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--plugin-kb") == 0)
+		{
+			options.plugin_kb = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--burst") == 0)
+		{
+			options.burst = (size_t)strtoul(value, NULL, 10);
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < options.plugins.size(); i++)
+	{
+		ok = RunBenchmark(options, options.plugins[i]) && ok;
+	}
+
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "parse") == 0)
+	{
+		return ParseBenchMain(argc - 1, argv + 1);
+	}
+	if (argc >= 2 && strcmp(argv[1], "generate") == 0)
+	{
+		return GenerateMain(argc - 1, argv + 1);
+	}
+	if (argc >= 2 && strcmp(argv[1], "check") == 0)
+	{
+		return CheckMain(argc - 1, argv + 1);
+	}
+	if (argc >= 2 && strcmp(argv[1], "switch") == 0)
+	{
+		return SwitchBenchMain(argc - 1, argv + 1);
+	}
+	if (argc >= 2 && argv[1][0] != '-')
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	return SwitchBenchMain(argc, argv);
+}
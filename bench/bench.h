@@ -0,0 +1,61 @@
+#ifndef _INCLUDE_MODEGROUP_BENCH_H_
+#define _INCLUDE_MODEGROUP_BENCH_H_
+
+/**
+ * @file bench.h
+ * @brief Helpers shared by the benchmark modes.
+ */
+
+#include <string>
+#include <vector>
+
+bool MakeDir(const std::string &path);
+void RemoveTree(const char *path);
+bool WriteTextFile(const std::string &path, const std::string &text);
+
+/**
+ * Parses a comma separated list of numbers such as "10,100,1000".
+ */
+void ParseList(const char *arg, std::vector<size_t> &values);
+
+double Percentile(std::vector<double> values, double percent);
+
+/**
+ * Prints ,"name":{"min":..,"p50":..,"p90":..,"max":..} to stdout.
+ */
+void PrintDistribution(const char *name, const std::vector<double> &values);
+
+/**
+ * Shape of a synthetic modegroup.cfg written by GenerateConfig().
+ */
+struct GeneratorOptions
+{
+	GeneratorOptions() : groups(1000), first_group(0), seed(1), cvars(20), commands(3), load_plugins(6),
+		unload_plugins(2), settings(true), lazy_parse(false)
+	{
+	}
+
+	size_t groups;
+	size_t first_group; // number in the name of the first group
+	unsigned int seed;
+	size_t cvars;
+	size_t commands;
+	size_t load_plugins;
+	size_t unload_plugins;
+	bool settings;      // write a "Settings" section
+	bool lazy_parse;
+};
+
+/**
+ * Writes a synthetic config. The counts are per group averages, each group
+ * gets a random count between zero and twice the average.
+ */
+void GenerateConfig(const GeneratorOptions &options, std::string &cfg);
+
+void PrintUsage();
+
+int ParseBenchMain(int argc, char **argv);
+int GenerateMain(int argc, char **argv);
+int CheckMain(int argc, char **argv);
+
+#endif // _INCLUDE_MODEGROUP_BENCH_H_
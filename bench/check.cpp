@@ -0,0 +1,471 @@
+/**
+ * @file check.cpp
+ * @brief Behavioural checks of the config reader, the cache and lazy parsing.
+ *
+ *   modegroup_bench check [--groups 1000] [--seed 1]
+ *
+ * reader: runs ConfigReader and the SMC parser in fakes.cpp over the same
+ * corpus: hand written cases for escapes, comments and every error the
+ * reader can report, followed by generated configs like the ones the parse
+ * benchmark uses. Both parsers have to produce the same sections and
+ * key/value pairs, the same error code and the same error line, and the
+ * hand written cases also have to match the result SourceMod gives for them.
+ *
+ * load: parses a generated config with ParseConfig() and checks that every
+ * other way of getting its groups gives the same table: a ConfigCache
+ * round trip, groups imported from the cached table after its ID arena was
+ * copied out, and the same config with lazy_parse, each group parsed with
+ * ParseModeGroup() from the index and from a table it was imported into.
+ * A cache read with the wrong source hash or a damaged byte has to fail.
+ *
+ * Prints one JSON object per check on stdout, every mismatch on stderr, and
+ * exits with 1 if anything did not match.
+ */
+
+#include "bench.h"
+#include "fakes.h"
+#include "extension.h"
+#include "configcache.h"
+#include "configreader.h"
+#include <ITextParsers.h>
+#include <cstdlib>
+#include <unistd.h>
+
+struct ReaderCase
+{
+	const char *name;
+	const char *text;
+	SMCError error;
+	unsigned int line;      // line of the error, ignored when error is SMCError_Okay
+	const char *events;     // what a successful parse reports, NULL to only compare the parsers
+};
+
+static const ReaderCase g_ReaderCases[] =
+{
+	{ "quoted", "\"A\"\n{\n\t\"k\"\t\"v\"\n}\n", SMCError_Okay, 0, "{A|k=v|}|" },
+	{ "bare", "A { k v }", SMCError_Okay, 0, "{A|k=v|}|" },
+	{ "bom", "\xEF\xBB\xBF\"A\" { }", SMCError_Okay, 0, "{A|}|" },
+	{ "escapes", "\"A\" { \"k\" \"a\\nb\\tc\\\\d\\\"e\\rf\" }", SMCError_Okay, 0, "{A|k=a\nb\tc\\d\"e\rf|}|" },
+	{ "unknown escape", "\"A\" { \"k\" \"C:\\x\\games\" }", SMCError_Okay, 0, "{A|k=C:xgames|}|" },
+	{ "escaped name", "\"A\\\"B\" { }", SMCError_Okay, 0, "{A\"B|}|" },
+	{ "comments", "// c\n/* multi\nline */ \"A\" /* x */ { \"k\" \"v\" // t\n}", SMCError_Okay, 0, "{A|k=v|}|" },
+	{ "bare before comment", "A { k v//c\n}", SMCError_Okay, 0, "{A|k=v|}|" },
+	{ "comment in string", "\"A\" { \"k\" \"// not /* a comment\" }", SMCError_Okay, 0, "{A|k=// not /* a comment|}|" },
+	{ "nested", "\"A\" { \"B\" { \"k\" \"v\" } \"k2\" \"v2\" }", SMCError_Okay, 0, "{A|{B|k=v|}|k2=v2|}|" },
+	{ "unterminated comment", "\"A\"\n{\n/* open\n\n", SMCError_InvalidTokens, 3, NULL },
+	{ "unterminated string", "\"A\"\n{\n\"k\" \"v\n}", SMCError_InvalidTokens, 3, NULL },
+	{ "backslash before newline", "\"A\" { \"k\" \"v\\\n\" }", SMCError_InvalidTokens, 1, NULL },
+	{ "section without name", "\n{\n}", SMCError_InvalidSection2, 2, NULL },
+	{ "key before close", "\"A\"\n{\n\"k\"\n}", SMCError_InvalidSection3, 4, NULL },
+	{ "extra close", "\"A\" { }\n}", SMCError_InvalidSection4, 2, NULL },
+	{ "unclosed section", "\"A\"\n{\n\"k\" \"v\"\n", SMCError_InvalidSection5, 4, NULL },
+	{ "property outside section", "\"k\"\n\"v\"", SMCError_InvalidProperty1, 1, NULL },
+	{ "dangling key", "\"A\" { }\n\"B\"", SMCError_InvalidTokens, 2, NULL },
+};
+
+/**
+ * Both listeners write what they are told into the same string form:
+ * "{name|" for a section, "key=value|" for a pair and "}|" when leaving.
+ */
+class SMCRecorder : public ITextListener_SMC
+{
+public:
+	SMCResult ReadSMC_NewSection(const SMCStates *states, const char *name) override
+	{
+		events += "{";
+		events += name;
+		events += "|";
+		return SMCResult_Continue;
+	}
+
+	SMCResult ReadSMC_KeyValue(const SMCStates *states, const char *key, const char *value) override
+	{
+		events += key;
+		events += "=";
+		events += value;
+		events += "|";
+		return SMCResult_Continue;
+	}
+
+	SMCResult ReadSMC_LeavingSection(const SMCStates *states) override
+	{
+		events += "}|";
+		return SMCResult_Continue;
+	}
+
+public:
+	std::string events;
+};
+
+class ReaderRecorder : public ConfigReaderListener
+{
+public:
+	void OnSection(const ConfigString &name) override
+	{
+		events += "{";
+		events.append(name.str, name.length);
+		events += "|";
+	}
+
+	void OnKeyValue(const ConfigString &key, const ConfigString &value) override
+	{
+		events.append(key.str, key.length);
+		events += "=";
+		events.append(value.str, value.length);
+		events += "|";
+	}
+
+	void OnLeavingSection() override
+	{
+		events += "}|";
+	}
+
+public:
+	std::string events;
+};
+
+/**
+ * Parses text with both parsers and compares them, and with the expected
+ * result when there is one. Returns false and prints why on a mismatch.
+ */
+static bool CheckReaderCase(const char *name, const std::string &text, const ReaderCase *expected)
+{
+	SMCRecorder smc;
+	SMCStates smcStates;
+	char buffer[256];
+	SMCError smcError = textparsers->ParseSMCStream(text.data(), text.size(), &smc, &smcStates, buffer, sizeof(buffer));
+
+	ConfigReader reader;
+	ReaderRecorder read;
+	SMCStates readStates;
+	SMCError readError = reader.Parse(text.data(), text.size(), &read, &readStates);
+
+	bool ok = true;
+	if (smcError != readError || (readError != SMCError_Okay && smcStates.line != readStates.line))
+	{
+		fprintf(stderr, "E %s: SMC gives error %d on line %u, ConfigReader error %d on line %u\n",
+			name, (int)smcError, smcStates.line, (int)readError, readStates.line);
+		ok = false;
+	}
+	if (smc.events != read.events)
+	{
+		fprintf(stderr, "E %s: SMC reports \"%s\", ConfigReader \"%s\"\n", name, smc.events.c_str(), read.events.c_str());
+		ok = false;
+	}
+
+	if (expected)
+	{
+		if (readError != expected->error || (readError != SMCError_Okay && readStates.line != expected->line))
+		{
+			fprintf(stderr, "E %s: expected error %d on line %u, got error %d on line %u\n",
+				name, (int)expected->error, expected->line, (int)readError, readStates.line);
+			ok = false;
+		}
+		if (expected->events && read.events != expected->events)
+		{
+			fprintf(stderr, "E %s: expected \"%s\", got \"%s\"\n", name, expected->events, read.events.c_str());
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+static bool CheckReader(size_t groups, unsigned int seed)
+{
+	size_t cases = 0;
+	size_t failed = 0;
+
+	for (size_t i = 0; i < sizeof(g_ReaderCases) / sizeof(g_ReaderCases[0]); i++)
+	{
+		cases++;
+		if (!CheckReaderCase(g_ReaderCases[i].name, g_ReaderCases[i].text, &g_ReaderCases[i]))
+		{
+			failed++;
+		}
+	}
+
+	// 生成的配置: 同一个种子下的完整配置, lazy_parse 配置和只有分组的拆分文件
+	for (int variant = 0; variant < 3; variant++)
+	{
+		GeneratorOptions generator;
+		generator.groups = groups;
+		generator.seed = seed + (unsigned int)variant;
+		generator.lazy_parse = variant == 1;
+		generator.settings = variant != 2;
+
+		std::string cfg;
+		GenerateConfig(generator, cfg);
+
+		char name[64];
+		ke::SafeSprintf(name, sizeof(name), "generated seed %u", generator.seed);
+		cases++;
+		if (!CheckReaderCase(name, cfg, NULL))
+		{
+			failed++;
+		}
+
+		// 每个截断的前缀都是一个出错的配置, 两边报的错误和行号也要一样
+		for (size_t length = 0; length < cfg.size() && length < 4096; length += 7)
+		{
+			ke::SafeSprintf(name, sizeof(name), "generated seed %u cut at %zu", generator.seed, length);
+			cases++;
+			if (!CheckReaderCase(name, cfg.substr(0, length), NULL))
+			{
+				failed++;
+			}
+		}
+	}
+
+	printf("{\"check\":\"reader\",\"cases\":%zu,\"failed\":%zu}\n", cases, failed);
+	fflush(stdout);
+	return failed == 0;
+}
+
+static void DescribeIds(const ModeGroupTable &table, IdSpan span, std::string &out)
+{
+	const StringId *ids = table.GetIds(span);
+	for (uint32_t i = 0; i < span.count; i++)
+	{
+		out += i ? "," : "";
+		out += table.GetString(ids[i]);
+	}
+	out += "|";
+}
+
+/**
+ * Everything a switch uses from a group as one string, so two tables can be
+ * compared group by group without relying on their string IDs.
+ */
+static std::string DescribeGroup(const ModeGroupTable &table, const ModeGroup &group)
+{
+	std::string out = table.GetString(group.name);
+	out += "|";
+	out += table.GetString(group.plugin_directory);
+	out += group.use_sm_cvar ? "|sm_cvar|" : "|-|";
+	out += group.suspend_on_leave ? "suspend|" : "-|";
+	DescribeIds(table, group.load_plugins, out);
+	DescribeIds(table, group.unload_plugins, out);
+	DescribeIds(table, group.cvars, out);
+	DescribeIds(table, group.commands, out);
+	return out;
+}
+
+/**
+ * Compares every group of table with the group of the same name in
+ * expected, parsing lazy groups first. Returns the number of mismatches.
+ */
+static size_t CompareTables(const char *what, const ModeGroupTable &expected, const ModeGroupTable &table)
+{
+	size_t failed = 0;
+	if (table.Count() != expected.Count())
+	{
+		fprintf(stderr, "E %s: %zu groups, expected %zu\n", what, table.Count(), expected.Count());
+		failed++;
+	}
+
+	for (size_t i = 0; i < table.Count(); i++)
+	{
+		const ModeGroup *pGroup = &table.Get(i);
+		const ModeGroupTable *pTable = &table;
+		ModeGroupTable body;
+		if (!pGroup->parsed)
+		{
+			if (!g_ModeGroupExtension.ParseModeGroup(table, *pGroup, body))
+			{
+				fprintf(stderr, "E %s: group %s did not parse\n", what, table.GetString(pGroup->name));
+				failed++;
+				continue;
+			}
+			pTable = &body;
+			pGroup = &body.Get(0);
+		}
+
+		const ModeGroup *pExpected = expected.Find(pTable->GetString(pGroup->name));
+		std::string got = DescribeGroup(*pTable, *pGroup);
+		std::string want = pExpected ? DescribeGroup(expected, *pExpected) : std::string("(missing)");
+		if (got != want)
+		{
+			fprintf(stderr, "E %s: got \"%s\", expected \"%s\"\n", what, got.c_str(), want.c_str());
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+static bool IsSameSettings(const ModeGroupSettings &a, const ModeGroupSettings &b)
+{
+	return a.incremental_switch == b.incremental_switch
+		&& a.frame_budget_ms == b.frame_budget_ms
+		&& a.prepare_timeout == b.prepare_timeout
+		&& a.prepare_mlock == b.prepare_mlock
+		&& a.prepare_memory_cap == b.prepare_memory_cap
+		&& a.lazy_parse == b.lazy_parse
+		&& a.switch_debounce_ms == b.switch_debounce_ms
+		&& a.suspend_memory_cap == b.suspend_memory_cap;
+}
+
+static bool CheckLoad(size_t groups, unsigned int seed)
+{
+	char root[] = "/tmp/modegroup-check-XXXXXX";
+	if (!mkdtemp(root))
+	{
+		fprintf(stderr, "E Could not create a temporary directory\n");
+		return false;
+	}
+
+	GeneratorOptions generator;
+	generator.groups = groups;
+	generator.seed = seed;
+	std::string cfg, lazyCfg;
+	GenerateConfig(generator, cfg);
+	generator.lazy_parse = true;
+	GenerateConfig(generator, lazyCfg);
+
+	std::string cfgPath = std::string(root) + "/modegroup.cfg";
+	std::string lazyPath = std::string(root) + "/modegroup_lazy.cfg";
+	std::string cachePath = std::string(root) + "/modegroup.cache";
+	if (!WriteTextFile(cfgPath, cfg) || !WriteTextFile(lazyPath, lazyCfg))
+	{
+		fprintf(stderr, "E Could not write %s\n", cfgPath.c_str());
+		RemoveTree(root);
+		return false;
+	}
+
+	size_t failed = 0;
+	char error[256];
+
+	// 完整解析的结果作为标准, 其他方式得到的表都和它比较
+	ModeGroupTable parsed;
+	ModeGroupSettings parsedSettings;
+	uint64_t hash = 0;
+	if (!ModeGroupExtension::HashFile(cfgPath.c_str(), &hash)
+		|| !g_ModeGroupExtension.ParseConfig(cfgPath.c_str(), parsed, parsedSettings, error, sizeof(error)))
+	{
+		fprintf(stderr, "E %s\n", error);
+		RemoveTree(root);
+		return false;
+	}
+	if (parsed.Count() != groups)
+	{
+		fprintf(stderr, "E parse: %zu groups, generated %zu\n", parsed.Count(), groups);
+		failed++;
+	}
+
+	ModeGroupTable cached;
+	ModeGroupSettings cachedSettings;
+	if (!ConfigCache::Write(cachePath.c_str(), hash, parsed, parsedSettings)
+		|| !ConfigCache::Read(cachePath.c_str(), hash, cached, cachedSettings))
+	{
+		fprintf(stderr, "E cache: could not write and read back %s\n", cachePath.c_str());
+		failed++;
+	}
+	else
+	{
+		failed += CompareTables("cache", parsed, cached);
+		if (!IsSameSettings(parsedSettings, cachedSettings))
+		{
+			fprintf(stderr, "E cache: settings differ\n");
+			failed++;
+		}
+
+		// 往映射的表里加 ID 会先把 ID 数组复制出来, 已有的分组不能变
+		StringId extra = cached.Intern("check_extra");
+		cached.AddIds(&extra, 1);
+		failed += CompareTables("cache after AddIds", parsed, cached);
+
+		ModeGroupTable merged;
+		for (size_t i = 0; i < cached.Count(); i++)
+		{
+			merged.Import(cached, cached.Get(i));
+		}
+		failed += CompareTables("imported from cache", parsed, merged);
+	}
+
+	// 哈希对不上或者内容损坏的缓存都不能用
+	ModeGroupTable stale;
+	ModeGroupSettings staleSettings;
+	if (ConfigCache::Read(cachePath.c_str(), hash + 1, stale, staleSettings) || stale.Count() != 0)
+	{
+		fprintf(stderr, "E cache: read with the wrong source hash succeeded\n");
+		failed++;
+	}
+
+	std::string damaged;
+	if (ReadConfigFile(cachePath.c_str(), damaged) && damaged.size() > 64)
+	{
+		damaged[damaged.size() / 2] ^= 0x5A;
+		std::string damagedPath = cachePath + ".damaged";
+		ModeGroupTable broken;
+		ModeGroupSettings brokenSettings;
+		if (!WriteTextFile(damagedPath, damaged)
+			|| ConfigCache::Read(damagedPath.c_str(), hash, broken, brokenSettings) || broken.Count() != 0)
+		{
+			fprintf(stderr, "E cache: a damaged cache was read\n");
+			failed++;
+		}
+	}
+
+	// lazy_parse 只建索引, 每个分组第一次用到时解析的结果要和完整解析一样
+	ModeGroupTable lazy;
+	ModeGroupSettings lazySettings;
+	if (!g_ModeGroupExtension.ParseConfig(lazyPath.c_str(), lazy, lazySettings, error, sizeof(error)))
+	{
+		fprintf(stderr, "E lazy: %s\n", error);
+		failed++;
+	}
+	else
+	{
+		failed += CompareTables("lazy", parsed, lazy);
+
+		ModeGroupTable merged;
+		for (size_t i = 0; i < lazy.Count(); i++)
+		{
+			merged.Import(lazy, lazy.Get(i));
+		}
+		failed += CompareTables("imported from lazy", parsed, merged);
+	}
+
+	printf("{\"check\":\"load\",\"groups\":%zu,\"seed\":%u,\"failed\":%zu}\n", groups, seed, failed);
+	fflush(stdout);
+
+	RemoveTree(root);
+	return failed == 0;
+}
+
+int CheckMain(int argc, char **argv)
+{
+	size_t groups = 1000;
+	unsigned int seed = 1;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const char *arg = argv[i];
+		const char *value = argv[i + 1];
+
+		if (strcmp(arg, "--groups") == 0)
+		{
+			groups = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--seed") == 0)
+		{
+			seed = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (argc % 2 == 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	bool ok = CheckReader(groups, seed);
+	ok = CheckLoad(groups, seed) && ok;
+	return ok ? 0 : 1;
+}
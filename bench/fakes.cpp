@@ -0,0 +1,793 @@
+#include "fakes.h"
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <dirent.h>
+#include <sys/stat.h>
+
+BenchHost g_BenchHost;
+
+BenchCosts::BenchCosts() : load_us(0), unload_us(0), command_us(0), line_us(0)
+{
+}
+
+class FakeSourceMod : public ISourceMod
+{
+public:
+	size_t BuildPath(PathType type, char *buffer, size_t maxlength, const char *format, ...) override
+	{
+		char path[PLATFORM_MAX_PATH];
+		va_list ap;
+		va_start(ap, format);
+		ke::SafeVsprintf(path, sizeof(path), format, ap);
+		va_end(ap);
+
+		const std::string &root = g_BenchHost.m_Root;
+		if (type == Path_Game)
+		{
+			return ke::SafeSprintf(buffer, maxlength, "%s/game/%s", root.c_str(), path);
+		}
+		return ke::SafeSprintf(buffer, maxlength, "%s/%s", root.c_str(), path);
+	}
+
+	void LogMessage(IExtension *pExt, const char *format, ...) override
+	{
+		if (!g_BenchHost.verbose)
+		{
+			return;
+		}
+
+		va_list ap;
+		va_start(ap, format);
+		fputs("L ", stderr);
+		vfprintf(stderr, format, ap);
+		fputc('\n', stderr);
+		va_end(ap);
+	}
+
+	void LogError(IExtension *pExt, const char *format, ...) override
+	{
+		va_list ap;
+		va_start(ap, format);
+		fputs("E ", stderr);
+		vfprintf(stderr, format, ap);
+		fputc('\n', stderr);
+		va_end(ap);
+	}
+
+	void AddGameFrameHook(GAME_FRAME_HOOK hook) override
+	{
+		g_BenchHost.m_FrameHooks.push_back(hook);
+	}
+
+	void RemoveGameFrameHook(GAME_FRAME_HOOK hook) override
+	{
+		for (size_t i = 0; i < g_BenchHost.m_FrameHooks.size(); i++)
+		{
+			if (g_BenchHost.m_FrameHooks[i] == hook)
+			{
+				g_BenchHost.m_FrameHooks.erase(g_BenchHost.m_FrameHooks.begin() + i);
+				break;
+			}
+		}
+	}
+};
+
+// 插件的内存占用按文件大小算
+class FakePlugin final : public IPlugin, public IPluginRuntime
+{
+public:
+	FakePlugin(const char *file, unsigned int size) : m_File(file), m_Status(Plugin_Running), m_Size(size)
+	{
+	}
+
+	const char *GetFilename() override
+	{
+		return m_File.c_str();
+	}
+
+	PluginStatus GetStatus() override
+	{
+		return m_Status;
+	}
+
+	bool SetPauseState(bool paused) override
+	{
+		m_Status = paused ? Plugin_Paused : Plugin_Running;
+		return true;
+	}
+
+	IPluginRuntime *GetRuntime() override
+	{
+		return this;
+	}
+
+	unsigned int GetMemUsage() override
+	{
+		return m_Size;
+	}
+
+private:
+	std::string m_File;
+	PluginStatus m_Status;
+	unsigned int m_Size;
+};
+
+class FakePluginIterator final : public IPluginIterator
+{
+public:
+	std::vector<IPlugin *> plugins;
+	size_t pos;
+
+	FakePluginIterator() : pos(0)
+	{
+	}
+
+	bool MorePlugins() override
+	{
+		return pos < plugins.size();
+	}
+	IPlugin *GetPlugin() override
+	{
+		return plugins[pos];
+	}
+	void NextPlugin() override
+	{
+		pos++;
+	}
+	void Release() override
+	{
+		delete this;
+	}
+};
+
+class FakePluginManager : public IPluginManager
+{
+public:
+	~FakePluginManager()
+	{
+		for (std::map<std::string, FakePlugin *>::iterator it = m_Plugins.begin(); it != m_Plugins.end(); ++it)
+		{
+			delete it->second;
+		}
+	}
+
+	IPlugin *LoadPlugin(const char *path, bool debug, PluginType type,
+		char error[], size_t maxlength, bool *wasloaded) override
+	{
+		std::map<std::string, FakePlugin *>::iterator it = m_Plugins.find(path);
+		if (it != m_Plugins.end())
+		{
+			*wasloaded = true;
+			return it->second;
+		}
+		*wasloaded = false;
+
+		// 和 SourceMod 一样先把整个文件读进来
+		std::string file = g_BenchHost.GetRoot() + "/plugins/" + path;
+		FILE *fp = fopen(file.c_str(), "rb");
+		if (!fp)
+		{
+			ke::SafeSprintf(error, maxlength, "Unable to open file");
+			return NULL;
+		}
+
+		char buffer[16384];
+		size_t read;
+		unsigned int size = 0;
+		while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		{
+			size += (unsigned int)read;
+		}
+		fclose(fp);
+
+		BenchHost::Spin(g_BenchHost.costs.load_us);
+		g_BenchHost.loads++;
+
+		FakePlugin *plugin = new FakePlugin(path, size);
+		m_Plugins[path] = plugin;
+		for (size_t i = 0; i < m_Listeners.size(); i++)
+		{
+			m_Listeners[i]->OnPluginCreated(plugin);
+		}
+		for (size_t i = 0; i < m_Listeners.size(); i++)
+		{
+			m_Listeners[i]->OnPluginLoaded(plugin);
+		}
+
+		return plugin;
+	}
+
+	bool UnloadPlugin(IPlugin *plugin) override
+	{
+		std::map<std::string, FakePlugin *>::iterator it = m_Plugins.find(plugin->GetFilename());
+		if (it == m_Plugins.end() || it->second != plugin)
+		{
+			return false;
+		}
+
+		BenchHost::Spin(g_BenchHost.costs.unload_us);
+		g_BenchHost.unloads++;
+
+		for (size_t i = 0; i < m_Listeners.size(); i++)
+		{
+			m_Listeners[i]->OnPluginUnloaded(plugin);
+		}
+		for (size_t i = 0; i < m_Listeners.size(); i++)
+		{
+			m_Listeners[i]->OnPluginDestroyed(plugin);
+		}
+
+		m_Plugins.erase(it);
+		delete (FakePlugin *)plugin;
+
+		return true;
+	}
+
+	IPluginIterator *GetPluginIterator() override
+	{
+		FakePluginIterator *iter = new FakePluginIterator();
+		for (std::map<std::string, FakePlugin *>::iterator it = m_Plugins.begin(); it != m_Plugins.end(); ++it)
+		{
+			iter->plugins.push_back(it->second);
+		}
+		return iter;
+	}
+
+	void AddPluginsListener(IPluginsListener *listener) override
+	{
+		m_Listeners.push_back(listener);
+	}
+
+	void RemovePluginsListener(IPluginsListener *listener) override
+	{
+		for (size_t i = 0; i < m_Listeners.size(); i++)
+		{
+			if (m_Listeners[i] == listener)
+			{
+				m_Listeners.erase(m_Listeners.begin() + i);
+				break;
+			}
+		}
+	}
+
+	size_t GetPluginCount() const
+	{
+		return m_Plugins.size();
+	}
+
+private:
+	std::map<std::string, FakePlugin *> m_Plugins;
+	std::vector<IPluginsListener *> m_Listeners;
+};
+
+/**
+ * The SMC grammar as ParseSMCStream() implements it, written independently
+ * of ConfigReader so the check mode can compare the two: quoted and bare
+ * strings, \n \r \t \\ \" escapes with the backslash dropped from any other
+ * escape, // and block comments, sections and key/value pairs, and the same
+ * error codes and lines as SourceMod.
+ */
+class FakeTextParsers : public ITextParsers
+{
+public:
+	SMCError ParseSMCFile(const char *file, ITextListener_SMC *smc_listener,
+		SMCStates *states, char *buffer, size_t maxsize) override
+	{
+		if (states)
+		{
+			states->line = 0;
+			states->col = 0;
+		}
+
+		FILE *fp = fopen(file, "rb");
+		if (!fp)
+		{
+			ke::SafeStrcpy(buffer, maxsize, "Stream failed to open");
+			return SMCError_StreamOpen;
+		}
+
+		std::string data;
+		char chunk[16384];
+		size_t read;
+		while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+		{
+			data.append(chunk, read);
+		}
+		fclose(fp);
+
+		return ParseSMCStream(data.data(), data.size(), smc_listener, states, buffer, maxsize);
+	}
+
+	SMCError ParseSMCStream(const char *stream, size_t length, ITextListener_SMC *smc_listener,
+		SMCStates *states, char *buffer, size_t maxsize) override
+	{
+		SMCStates local;
+		if (!states)
+		{
+			states = &local;
+		}
+		states->line = 1;
+		states->col = 1;
+
+		smc_listener->ReadSMC_ParseStart();
+
+		const char *p = stream;
+		const char *end = stream + length;
+		std::string key, token;
+		bool haveKey = false;
+		unsigned int keyLine = 0;
+		int depth = 0;
+		SMCError err = SMCError_Okay;
+		SMCResult res = SMCResult_Continue;
+
+		if (length >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+		{
+			p += 3;
+		}
+
+		while (p < end && res == SMCResult_Continue)
+		{
+			char c = *p;
+			if (c == '\n')
+			{
+				states->line++;
+				states->col = 1;
+				p++;
+				continue;
+			}
+			if (c == ' ' || c == '\t' || c == '\r')
+			{
+				states->col++;
+				p++;
+				continue;
+			}
+			if (c == '/' && p + 1 < end && p[1] == '/')
+			{
+				while (p < end && *p != '\n')
+				{
+					p++;
+				}
+				continue;
+			}
+			if (c == '/' && p + 1 < end && p[1] == '*')
+			{
+				unsigned int commentLine = states->line;
+				p += 2;
+				while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+				{
+					if (*p == '\n')
+					{
+						states->line++;
+						states->col = 1;
+					}
+					p++;
+				}
+				if (p + 1 >= end)
+				{
+					states->line = commentLine;
+					err = SMCError_InvalidTokens;
+					break;
+				}
+				p += 2;
+				continue;
+			}
+
+			if (c == '{')
+			{
+				if (!haveKey)
+				{
+					err = SMCError_InvalidSection2;
+					break;
+				}
+				res = smc_listener->ReadSMC_NewSection(states, key.c_str());
+				haveKey = false;
+				depth++;
+				states->col++;
+				p++;
+				continue;
+			}
+			if (c == '}')
+			{
+				if (haveKey)
+				{
+					err = SMCError_InvalidSection3;
+					break;
+				}
+				if (depth == 0)
+				{
+					err = SMCError_InvalidSection4;
+					break;
+				}
+				res = smc_listener->ReadSMC_LeavingSection(states);
+				depth--;
+				states->col++;
+				p++;
+				continue;
+			}
+
+			token.clear();
+			if (c == '"')
+			{
+				p++;
+				states->col++;
+				while (p < end && *p != '"' && *p != '\n')
+				{
+					if (*p == '\\' && p + 1 < end && p[1] != '\n')
+					{
+						p++;
+						states->col++;
+						switch (*p)
+						{
+						case 'n':
+							token += '\n';
+							break;
+						case 'r':
+							token += '\r';
+							break;
+						case 't':
+							token += '\t';
+							break;
+						default:
+							token += *p;
+							break;
+						}
+					}
+					else
+					{
+						token += *p;
+					}
+					p++;
+					states->col++;
+				}
+				if (p >= end || *p != '"')
+				{
+					err = SMCError_InvalidTokens;
+					break;
+				}
+				p++;
+				states->col++;
+			}
+			else
+			{
+				while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'
+					&& *p != '{' && *p != '}' && *p != '"'
+					&& !(*p == '/' && p + 1 < end && (p[1] == '/' || p[1] == '*')))
+				{
+					token += *p++;
+					states->col++;
+				}
+			}
+
+			if (!haveKey)
+			{
+				key.swap(token);
+				haveKey = true;
+				keyLine = states->line;
+			}
+			else if (depth == 0)
+			{
+				states->line = keyLine;
+				err = SMCError_InvalidProperty1;
+				break;
+			}
+			else
+			{
+				res = smc_listener->ReadSMC_KeyValue(states, key.c_str(), token.c_str());
+				haveKey = false;
+			}
+		}
+
+		if (err == SMCError_Okay && res == SMCResult_Continue && haveKey)
+		{
+			states->line = keyLine;
+			err = SMCError_InvalidTokens;
+		}
+		else if (err == SMCError_Okay && res == SMCResult_Continue && depth != 0)
+		{
+			err = SMCError_InvalidSection5;
+		}
+		if (err == SMCError_Okay && res == SMCResult_HaltFail)
+		{
+			err = SMCError_Custom;
+		}
+
+		if (err != SMCError_Okay)
+		{
+			ke::SafeSprintf(buffer, maxsize, "Parse error %d", (int)err);
+		}
+
+		smc_listener->ReadSMC_ParseEnd(res != SMCResult_Continue, err != SMCError_Okay);
+		return err;
+	}
+
+	const char *GetSMCErrorString(SMCError err) override
+	{
+		// SourceMod 的原文
+		static const char *errors[] =
+		{
+			"No error",
+			"Stream failed to open",
+			"Stream returned read error",
+			"Custom error",
+			"A section was declared without quotes, and had extra tokens",
+			"A section was declared without any header",
+			"A section ending was declared with too many unknown tokens",
+			"A section ending has no matching beginning",
+			"A section beginning has no matching ending",
+			"There were too many unidentifiable strings on one line",
+			"The token buffer overflowed",
+			"A property was declared outside of any section",
+		};
+
+		if (err < SMCError_Okay || (size_t)err >= sizeof(errors) / sizeof(errors[0]))
+		{
+			return NULL;
+		}
+		return errors[err];
+	}
+};
+
+class FakeGameHelpers : public IGameHelpers
+{
+public:
+	void ServerCommand(const char *buffer) override
+	{
+		unsigned int lines = 0;
+		for (const char *p = buffer; *p; p++)
+		{
+			if (*p == '\n')
+			{
+				lines++;
+			}
+		}
+
+		BenchHost::Spin(g_BenchHost.costs.command_us + lines * g_BenchHost.costs.line_us);
+		g_BenchHost.commands++;
+	}
+};
+
+class FakeDirectory final : public IDirectory
+{
+public:
+	FakeDirectory(DIR *dir, const char *path) : m_Dir(dir), m_Path(path), m_Entry(NULL)
+	{
+		NextEntry();
+	}
+
+	~FakeDirectory()
+	{
+		closedir(m_Dir);
+	}
+
+	bool MoreFiles() override
+	{
+		return m_Entry != NULL;
+	}
+
+	void NextEntry() override
+	{
+		m_Entry = readdir(m_Dir);
+	}
+
+	const char *GetEntryName() override
+	{
+		return m_Entry->d_name;
+	}
+
+	bool IsEntryDirectory() override
+	{
+		struct stat st;
+		std::string path = m_Path + "/" + m_Entry->d_name;
+		return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+	}
+
+private:
+	DIR *m_Dir;
+	std::string m_Path;
+	struct dirent *m_Entry;
+};
+
+class FakeLibrarySys : public ILibrarySys
+{
+public:
+	IDirectory *OpenDirectory(const char *path) override
+	{
+		DIR *dir = opendir(path);
+		if (!dir)
+		{
+			return NULL;
+		}
+		return new FakeDirectory(dir, path);
+	}
+
+	void CloseDirectory(IDirectory *dir) override
+	{
+		delete (FakeDirectory *)dir;
+	}
+
+	bool FileTime(const char *path, FileTimeType type, time_t *pTime) override
+	{
+		struct stat st;
+		if (stat(path, &st) != 0)
+		{
+			return false;
+		}
+
+		switch (type)
+		{
+		case FileTime_LastAccess:
+			*pTime = st.st_atime;
+			break;
+		case FileTime_Created:
+		case FileTime_LastChange:
+			*pTime = st.st_mtime;
+			break;
+		}
+		return true;
+	}
+};
+
+class FakeRootConsole : public IRootConsole
+{
+public:
+	bool AddRootConsoleCommand3(const char *cmd, const char *text, IRootConsoleCommand *pHandler) override
+	{
+		g_BenchHost.m_pRootCommand = pHandler;
+		return true;
+	}
+
+	bool RemoveRootConsoleCommand(const char *cmd, IRootConsoleCommand *pHandler) override
+	{
+		g_BenchHost.m_pRootCommand = NULL;
+		return true;
+	}
+
+	void ConsolePrint(const char *fmt, ...) override
+	{
+		if (!g_BenchHost.verbose)
+		{
+			return;
+		}
+
+		va_list ap;
+		va_start(ap, fmt);
+		fputs("C ", stderr);
+		vfprintf(stderr, fmt, ap);
+		fputc('\n', stderr);
+		va_end(ap);
+	}
+};
+
+class FakeForward final : public IForward
+{
+public:
+	int PushCell(cell_t cell) override
+	{
+		return 0;
+	}
+
+	int PushString(const char *string) override
+	{
+		return 0;
+	}
+
+	int Execute(cell_t *result, void *filter) override
+	{
+		if (result)
+		{
+			*result = 0;
+		}
+		return 0;
+	}
+};
+
+class FakeForwardManager : public IForwardManager
+{
+public:
+	IForward *CreateForward(const char *name, ExecType et, unsigned int num_params,
+		const ParamType *types, ...) override
+	{
+		return new FakeForward();
+	}
+
+	void ReleaseForward(IForward *forward) override
+	{
+		delete (FakeForward *)forward;
+	}
+};
+
+class FakeShareSys : public IShareSys
+{
+public:
+	void AddNatives(IExtension *myself, const sp_nativeinfo_t *natives) override
+	{
+	}
+};
+
+class BenchCommandArgs : public ICommandArgs
+{
+public:
+	std::vector<std::string> args;
+
+	const char *Arg(int n) const override
+	{
+		return n < (int)args.size() ? args[n].c_str() : "";
+	}
+
+	int ArgC() const override
+	{
+		return (int)args.size();
+	}
+};
+
+static FakeSourceMod g_FakeSourceMod;
+static FakePluginManager g_FakePluginManager;
+static FakeTextParsers g_FakeTextParsers;
+static FakeGameHelpers g_FakeGameHelpers;
+static FakeLibrarySys g_FakeLibrarySys;
+static FakeRootConsole g_FakeRootConsole;
+static FakeForwardManager g_FakeForwardManager;
+static FakeShareSys g_FakeShareSys;
+
+ISourceMod *g_pSM = &g_FakeSourceMod;
+ISourceMod *smutils = &g_FakeSourceMod;
+IExtension *myself = NULL;
+IPluginManager *plsys = &g_FakePluginManager;
+ITextParsers *textparsers = &g_FakeTextParsers;
+IGameHelpers *gamehelpers = &g_FakeGameHelpers;
+ILibrarySys *libsys = &g_FakeLibrarySys;
+IRootConsole *rootconsole = &g_FakeRootConsole;
+IForwardManager *forwards = &g_FakeForwardManager;
+IShareSys *sharesys = &g_FakeShareSys;
+
+BenchHost::BenchHost() : verbose(false), loads(0), unloads(0), commands(0), m_pRootCommand(NULL)
+{
+}
+
+void BenchHost::SetRoot(const std::string &root)
+{
+	m_Root = root;
+}
+
+void BenchHost::RunFrame()
+{
+	// 回调里可能移除自己, 先复制一份
+	std::vector<GAME_FRAME_HOOK> hooks = m_FrameHooks;
+	for (size_t i = 0; i < hooks.size(); i++)
+	{
+		hooks[i](true);
+	}
+}
+
+void BenchHost::RootCommand(const std::vector<std::string> &args)
+{
+	if (!m_pRootCommand)
+	{
+		return;
+	}
+
+	BenchCommandArgs cmdArgs;
+	cmdArgs.args.push_back("sm");
+	cmdArgs.args.push_back("modegroup");
+	cmdArgs.args.insert(cmdArgs.args.end(), args.begin(), args.end());
+	m_pRootCommand->OnRootConsoleCommand("modegroup", &cmdArgs);
+}
+
+size_t BenchHost::GetLoadedPluginCount() const
+{
+	return g_FakePluginManager.GetPluginCount();
+}
+
+void BenchHost::Spin(unsigned int us)
+{
+	if (!us)
+	{
+		return;
+	}
+
+	std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+	while (std::chrono::steady_clock::now() < until)
+	{
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef _INCLUDE_MODEGROUP_BENCH_FAKES_H_
+#define _INCLUDE_MODEGROUP_BENCH_FAKES_H_
+
+/**
+ * @file fakes.h
+ * @brief In-process SourceMod for the host-side benchmark.
+ */
+
+#include "smsdk_ext.h"
+#include <string>
+#include <vector>
+
+/**
+ * Simulated costs of the server calls a switch makes, in microseconds. The
+ * fakes busy-wait for this long so the time shows up the same way a real
+ * plugin load would: as main thread CPU time.
+ */
+struct BenchCosts
+{
+	BenchCosts();
+
+	unsigned int load_us;    // per plsys->LoadPlugin()
+	unsigned int unload_us;  // per plsys->UnloadPlugin()
+	unsigned int command_us; // per gamehelpers->ServerCommand()
+	unsigned int line_us;    // per line inside a ServerCommand() buffer
+};
+
+/**
+ * Controls the fake SourceMod. Paths built with Path_SM resolve below the
+ * root directory, Path_Game below root/game. Plugins are "loaded" by reading
+ * their file from root/plugins.
+ */
+class BenchHost
+{
+public:
+	BenchHost();
+
+	void SetRoot(const std::string &root);
+	const std::string &GetRoot() const
+	{
+		return m_Root;
+	}
+
+	/**
+	 * Runs the registered game frame hooks once.
+	 */
+	void RunFrame();
+	bool HasFrameHooks() const
+	{
+		return !m_FrameHooks.empty();
+	}
+
+	/**
+	 * Runs "sm modegroup <args>" as the root console would.
+	 */
+	void RootCommand(const std::vector<std::string> &args);
+
+	size_t GetLoadedPluginCount() const;
+
+	static void Spin(unsigned int us);
+
+public:
+	BenchCosts costs;
+	bool verbose;  // print LogMessage() and console output
+	size_t loads;
+	size_t unloads;
+	size_t commands;
+
+private:
+	friend class FakeSourceMod;
+	friend class FakeRootConsole;
+
+	std::string m_Root;
+	std::vector<GAME_FRAME_HOOK> m_FrameHooks;
+	IRootConsoleCommand *m_pRootCommand;
+};
+
+extern BenchHost g_BenchHost;
+
+#endif // _INCLUDE_MODEGROUP_BENCH_FAKES_H_
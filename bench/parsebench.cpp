@@ -0,0 +1,518 @@
+/**
+ * @file parsebench.cpp
+ * @brief Config parser throughput benchmark and large config generator.
+ *
+ *   modegroup_bench parse [--groups 10,100,1000,10000,50000] [--repeat 5] [--seed 1] [--keep]
+ *
+ * Generates a modegroup.cfg per group count and measures, with one JSON
+ * object per line on stdout:
+ *   - ParseConfig() alone: the ConfigReader parse into a fresh table
+ *   - the steps of LoadConfig() without a cache (hash, parse, cache write)
+ *     and with a valid cache (hash, cache read)
+ *   - ReloadConfig() after the file changed but no group did, until the new
+ *     table is live and the part of that spent on the main thread
+ *   - ParseConfig() of the same config with lazy_parse on, which only
+ *     indexes the groups, and the first use of one group afterwards
+ *   - LoadConfig() with the groups split over 16 files in configs/modegroups,
+ *     and ReloadConfig() after one of those files changed
+ * together with allocations, bytes allocated, peak heap growth and retained
+ * heap per group.
+ *
+ * The tokenizer, listener and table building are all the real extension
+ * code.
+ *
+ *   modegroup_bench generate --groups N [--seed 1] [--cvars 20] [--commands 3]
+ *                   [--load-plugins 6] [--unload-plugins 2] [--lazy-parse 0]
+ *                   [--output modegroup.cfg]
+ *
+ * Writes a synthetic config. The counts are per group averages, each group
+ * gets a random count between zero and twice the average.
+ */
+
+#include "bench.h"
+#include "alloccount.h"
+#include "fakes.h"
+#include "extension.h"
+#include "configcache.h"
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+// configs/modegroups 下拆成的文件数
+#define PARSE_BENCH_FILES	16
+
+/**
+ * xorshift32, so the same seed gives the same file on every platform.
+ */
+class BenchRandom
+{
+public:
+	BenchRandom(unsigned int seed) : m_State(seed ? seed : 1)
+	{
+	}
+
+	unsigned int Next()
+	{
+		m_State ^= m_State << 13;
+		m_State ^= m_State >> 17;
+		m_State ^= m_State << 5;
+		return m_State;
+	}
+
+	/**
+	 * Returns a value in [0, 2 * average].
+	 */
+	size_t Around(size_t average)
+	{
+		return average ? Next() % (2 * average + 1) : 0;
+	}
+
+private:
+	uint32_t m_State;
+};
+
+void GenerateConfig(const GeneratorOptions &options, std::string &cfg)
+{
+	BenchRandom random(options.seed);
+	char line[256];
+
+	cfg = "// Generated by modegroup_bench generate\n";
+	if (options.settings)
+	{
+		cfg += "\"Settings\"\n{\n\t\"switch_mode\"\t\"incremental\"\n\t\"frame_budget_ms\"\t\"2\"\n";
+		if (options.lazy_parse)
+		{
+			cfg += "\t\"lazy_parse\"\t\"1\"\n";
+		}
+		cfg += "}\n\n";
+	}
+	cfg += "\"ModeGroups\"\n{\n";
+
+	for (size_t i = options.first_group; i < options.first_group + options.groups; i++)
+	{
+		ke::SafeSprintf(line, sizeof(line), "\t\"group_%06zu\"\n\t{\n\t\t\"plugin_directory\"\t\"generated/group_%06zu\"\n", i, i);
+		cfg += line;
+		ke::SafeSprintf(line, sizeof(line), "\t\t\"use_sm_cvar\"\t\"%u\"\n", random.Next() % 2);
+		cfg += line;
+
+		size_t count = random.Around(options.load_plugins);
+		if (count)
+		{
+			cfg += "\t\t\"load_plugins\"\n\t\t{\n";
+			for (size_t j = 0; j < count; j++)
+			{
+				ke::SafeSprintf(line, sizeof(line), "\t\t\t\"p%zu\"\t\"common/plugin_%u.smx\"\n", j, random.Next() % 500);
+				cfg += line;
+			}
+			cfg += "\t\t}\n";
+		}
+
+		count = random.Around(options.unload_plugins);
+		if (count)
+		{
+			cfg += "\t\t\"unload_plugins\"\n\t\t{\n";
+			for (size_t j = 0; j < count; j++)
+			{
+				ke::SafeSprintf(line, sizeof(line), "\t\t\t\"p%zu\"\t\"common/plugin_%u.smx\"\n", j, random.Next() % 500);
+				cfg += line;
+			}
+			cfg += "\t\t}\n";
+		}
+
+		count = random.Around(options.cvars);
+		if (count)
+		{
+			cfg += "\t\t\"cvars\"\n\t\t{\n";
+			for (size_t j = 0; j < count; j++)
+			{
+				ke::SafeSprintf(line, sizeof(line), "\t\t\t\"gen_cvar_%u\"\t\"%u\"\n", random.Next() % 2000, random.Next() % 1000);
+				cfg += line;
+			}
+			cfg += "\t\t}\n";
+		}
+
+		count = random.Around(options.commands);
+		if (count)
+		{
+			cfg += "\t\t\"commands\"\n\t\t{\n";
+			for (size_t j = 0; j < count; j++)
+			{
+				ke::SafeSprintf(line, sizeof(line), "\t\t\t\"gen_cmd_%zu\"\t\"group_%06zu %u\"\n", j, i, random.Next() % 100);
+				cfg += line;
+			}
+			cfg += "\t\t}\n";
+		}
+
+		cfg += "\t}\n";
+	}
+
+	cfg += "}\n";
+}
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+/**
+ * Runs ReloadConfig() and waits for the loader thread to finish. Returns the
+ * time until the new table is live; mainMs gets the part of it spent on the
+ * main thread, starting the load and publishing the table.
+ */
+static double TimeReload(double &mainMs)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	g_ModeGroupExtension.ReloadConfig();
+	mainMs = ElapsedMs(start);
+
+	while (!g_ModeGroupExtension.IsConfigLoadDone())
+	{
+		std::this_thread::yield();
+	}
+
+	std::chrono::steady_clock::time_point publish = std::chrono::steady_clock::now();
+	g_ModeGroupExtension.WaitForConfigLoad();
+	mainMs += ElapsedMs(publish);
+
+	return ElapsedMs(start);
+}
+
+static bool RunParseBenchmark(size_t groups, size_t repeat, unsigned int seed, bool keep)
+{
+	char root[] = "/tmp/modegroup-parse-XXXXXX";
+	if (!mkdtemp(root))
+	{
+		fprintf(stderr, "E Could not create a temporary directory\n");
+		return false;
+	}
+
+	GeneratorOptions generator;
+	generator.groups = groups;
+	generator.seed = seed;
+
+	std::string cfg;
+	GenerateConfig(generator, cfg);
+
+	std::string cfgPath = std::string(root) + "/configs/modegroup.cfg";
+	std::string cachePath = std::string(root) + "/data/modegroup.cache";
+	if (!MakeDir(std::string(root) + "/configs") || !MakeDir(std::string(root) + "/data")
+		|| !WriteTextFile(cfgPath, cfg))
+	{
+		fprintf(stderr, "E Could not write %s\n", cfgPath.c_str());
+		RemoveTree(root);
+		return false;
+	}
+	g_BenchHost.SetRoot(root);
+
+	char error[256];
+	std::vector<double> parseMs;
+	AllocSnapshot before, after;
+	int64_t peak = 0;
+	int64_t retained = 0;
+	size_t parsed = 0;
+
+	for (size_t i = 0; i < repeat; i++)
+	{
+		ModeGroupTable table;
+		ModeGroupSettings settings;
+
+		AllocCounter::ResetPeak();
+		before = AllocCounter::Get();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		if (!g_ModeGroupExtension.ParseConfig(cfgPath.c_str(), table, settings, error, sizeof(error)))
+		{
+			fprintf(stderr, "E %s\n", error);
+			RemoveTree(root);
+			return false;
+		}
+
+		parseMs.push_back(ElapsedMs(start));
+		after = AllocCounter::Get();
+		peak = after.peak - before.live;
+		retained = after.live - before.live;
+		parsed = table.Count();
+	}
+
+	uint64_t allocations = after.allocations - before.allocations;
+	uint64_t bytes = after.bytes - before.bytes;
+
+	// 同样的分组打开 lazy_parse, 只建索引, 然后第一次用到中间的一个分组
+	GeneratorOptions lazyGenerator = generator;
+	lazyGenerator.lazy_parse = true;
+	std::string lazyCfg;
+	GenerateConfig(lazyGenerator, lazyCfg);
+	std::string lazyPath = std::string(root) + "/configs/modegroup_lazy.cfg";
+	if (!WriteTextFile(lazyPath, lazyCfg))
+	{
+		fprintf(stderr, "E Could not write %s\n", lazyPath.c_str());
+		RemoveTree(root);
+		return false;
+	}
+
+	std::vector<double> lazyMs;
+	double firstUseMs = 0.0;
+	int64_t lazyRetained = 0;
+	for (size_t i = 0; i < repeat; i++)
+	{
+		ModeGroupTable table;
+		ModeGroupSettings settings;
+
+		AllocSnapshot lazyBefore = AllocCounter::Get();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		if (!g_ModeGroupExtension.ParseConfig(lazyPath.c_str(), table, settings, error, sizeof(error)))
+		{
+			fprintf(stderr, "E %s\n", error);
+			RemoveTree(root);
+			return false;
+		}
+
+		lazyMs.push_back(ElapsedMs(start));
+		lazyRetained = AllocCounter::Get().live - lazyBefore.live;
+
+		if (table.Count())
+		{
+			ModeGroupTable body;
+			start = std::chrono::steady_clock::now();
+			g_ModeGroupExtension.ParseModeGroup(table, table.Get(table.Count() / 2), body);
+			firstUseMs = ElapsedMs(start);
+		}
+	}
+
+	// 和 LoadConfig 一样的步骤, 但是用新表, 不把清空旧表的时间算进去
+	ModeGroupTable coldTable, cachedTable;
+	ModeGroupSettings coldSettings, cachedSettings;
+	uint64_t hash;
+
+	unlink(cachePath.c_str());
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool ok = ModeGroupExtension::HashFile(cfgPath.c_str(), &hash)
+		&& g_ModeGroupExtension.ParseConfig(cfgPath.c_str(), coldTable, coldSettings, error, sizeof(error))
+		&& ConfigCache::Write(cachePath.c_str(), hash, coldTable, coldSettings);
+	double loadColdMs = ElapsedMs(start);
+
+	AllocSnapshot cachedBefore = AllocCounter::Get();
+	start = std::chrono::steady_clock::now();
+	ok = ok && ModeGroupExtension::HashFile(cfgPath.c_str(), &hash)
+		&& ConfigCache::Read(cachePath.c_str(), hash, cachedTable, cachedSettings);
+	double loadCachedMs = ElapsedMs(start);
+	AllocSnapshot cachedAfter = AllocCounter::Get();
+
+	coldTable.Clear();
+	cachedTable.Clear();
+	ok = ok && g_ModeGroupExtension.LoadConfig(error, sizeof(error));
+
+	// 文件变了但是分组都没变, 走完整的解析和比较
+	cfg += "// touched\n";
+	ok = ok && WriteTextFile(cfgPath, cfg);
+	double reloadMainMs;
+	double reloadMs = TimeReload(reloadMainMs);
+
+	// 同样的分组分到 configs/modegroups 下的多个文件, modegroup.cfg 只留设置
+	GeneratorOptions mainGenerator = generator;
+	mainGenerator.groups = 0;
+	std::string mainCfg;
+	GenerateConfig(mainGenerator, mainCfg);
+	ok = ok && WriteTextFile(cfgPath, mainCfg) && MakeDir(std::string(root) + "/configs/modegroups");
+
+	std::string firstPart, firstPartPath;
+	for (size_t i = 0; i < PARSE_BENCH_FILES && ok; i++)
+	{
+		GeneratorOptions partGenerator = generator;
+		partGenerator.first_group = groups * i / PARSE_BENCH_FILES;
+		partGenerator.groups = groups * (i + 1) / PARSE_BENCH_FILES - partGenerator.first_group;
+		partGenerator.seed = seed + (unsigned int)i;
+		partGenerator.settings = false;
+
+		char name[64];
+		ke::SafeSprintf(name, sizeof(name), "/configs/modegroups/part_%02zu.cfg", i);
+		std::string partCfg;
+		GenerateConfig(partGenerator, partCfg);
+		ok = WriteTextFile(std::string(root) + name, partCfg);
+
+		if (i == 0)
+		{
+			firstPart = partCfg;
+			firstPartPath = std::string(root) + name;
+		}
+	}
+
+	start = std::chrono::steady_clock::now();
+	ok = ok && g_ModeGroupExtension.LoadConfig(error, sizeof(error));
+	double filesLoadMs = ElapsedMs(start);
+
+	// 只改一个文件, 其他文件沿用各自的表
+	firstPart += "// touched\n";
+	ok = ok && WriteTextFile(firstPartPath, firstPart);
+	double filesReloadMainMs;
+	double filesReloadMs = TimeReload(filesReloadMainMs);
+
+	if (!ok)
+	{
+		fprintf(stderr, "E LoadConfig failed: %s\n", error);
+	}
+	else
+	{
+		double perGroup = parsed ? (double)parsed : 1.0;
+		double parseP50 = Percentile(parseMs, 50.0);
+
+		printf("{\"bench\":\"parse\",\"groups\":%zu,\"parsed\":%zu,\"bytes\":%zu,\"repeat\":%zu,\"seed\":%u",
+			groups, parsed, cfg.size(), repeat, seed);
+		PrintDistribution("parse_ms", parseMs);
+		printf(",\"parse_mb_s\":%.1f", parseP50 > 0.0 ? (cfg.size() / (1024.0 * 1024.0)) / (parseP50 / 1000.0) : 0.0);
+		printf(",\"allocs_per_group\":%.1f,\"alloc_bytes_per_group\":%.0f,\"peak_bytes_per_group\":%.0f,\"retained_bytes_per_group\":%.0f",
+			allocations / perGroup, bytes / perGroup, peak / perGroup, retained / perGroup);
+		printf(",\"load_cold_ms\":%.3f,\"load_cached_ms\":%.3f,\"load_cached_allocs_per_group\":%.1f,\"reload_ms\":%.3f,\"reload_main_thread_ms\":%.3f",
+			loadColdMs, loadCachedMs, (cachedAfter.allocations - cachedBefore.allocations) / perGroup, reloadMs, reloadMainMs);
+		PrintDistribution("lazy_index_ms", lazyMs);
+		printf(",\"lazy_first_use_ms\":%.3f,\"lazy_retained_bytes_per_group\":%.0f",
+			firstUseMs, lazyRetained / perGroup);
+		printf(",\"files\":%d,\"files_load_ms\":%.3f,\"files_reload_one_ms\":%.3f,\"files_reload_one_main_thread_ms\":%.3f}\n",
+			PARSE_BENCH_FILES, filesLoadMs, filesReloadMs, filesReloadMainMs);
+		fflush(stdout);
+	}
+
+	if (!keep)
+	{
+		RemoveTree(root);
+	}
+	else
+	{
+		fprintf(stderr, "Kept %s\n", root);
+	}
+
+	return ok;
+}
+
+int ParseBenchMain(int argc, char **argv)
+{
+	std::vector<size_t> groups;
+	ParseList("10,100,1000,10000,50000", groups);
+	size_t repeat = 5;
+	unsigned int seed = 1;
+	bool keep = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--keep") == 0)
+		{
+			keep = true;
+			continue;
+		}
+		if (strcmp(arg, "--verbose") == 0)
+		{
+			g_BenchHost.verbose = true;
+			continue;
+		}
+		if (!value)
+		{
+			PrintUsage();
+			return 1;
+		}
+		i++;
+
+		if (strcmp(arg, "--groups") == 0)
+		{
+			ParseList(value, groups);
+		}
+		else if (strcmp(arg, "--repeat") == 0)
+		{
+			repeat = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--seed") == 0)
+		{
+			seed = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (repeat < 1)
+	{
+		repeat = 1;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < groups.size(); i++)
+	{
+		ok = RunParseBenchmark(groups[i], repeat, seed, keep) && ok;
+	}
+
+	return ok ? 0 : 1;
+}
+
+int GenerateMain(int argc, char **argv)
+{
+	GeneratorOptions options;
+	const char *output = "modegroup.cfg";
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const char *arg = argv[i];
+		const char *value = argv[i + 1];
+
+		if (strcmp(arg, "--groups") == 0)
+		{
+			options.groups = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--seed") == 0)
+		{
+			options.seed = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--cvars") == 0)
+		{
+			options.cvars = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--commands") == 0)
+		{
+			options.commands = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--load-plugins") == 0)
+		{
+			options.load_plugins = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--unload-plugins") == 0)
+		{
+			options.unload_plugins = (size_t)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--lazy-parse") == 0)
+		{
+			options.lazy_parse = atoi(value) != 0;
+		}
+		else if (strcmp(arg, "--output") == 0)
+		{
+			output = value;
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	if (argc % 2 == 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	std::string cfg;
+	GenerateConfig(options, cfg);
+	if (!WriteTextFile(output, cfg))
+	{
+		fprintf(stderr, "E Could not write %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "Wrote %zu groups (%zu bytes) to %s\n", options.groups, cfg.size(), output);
+	return 0;
+}
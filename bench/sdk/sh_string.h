@@ -0,0 +1,6 @@
+/**
+ * @file sh_string.h
+ * @brief Benchmark stand-in, everything is declared in smsdk_ext.h.
+ */
+
+#include "smsdk_ext.h"
@@ -0,0 +1,410 @@
+#ifndef _INCLUDE_MODEGROUP_BENCH_SMSDK_EXT_H_
+#define _INCLUDE_MODEGROUP_BENCH_SMSDK_EXT_H_
+
+/**
+ * @file smsdk_ext.h
+ * @brief Stand-in for the SourceMod SDK used by the host-side benchmark.
+ *
+ * Declares only the parts of the SourceMod and SourcePawn interfaces the
+ * extension actually calls, with the same names and signatures, so the
+ * extension sources compile unchanged without a SourceMod checkout. The
+ * implementations live in bench/fakes.cpp.
+ */
+
+#include "smsdk_config.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdarg>
+#include <ctime>
+
+#if defined _WIN32
+#define PLATFORM_WINDOWS
+#define PLATFORM_MAX_PATH	260
+#else
+#define PLATFORM_POSIX
+#define PLATFORM_MAX_PATH	4096
+#endif
+
+typedef int32_t cell_t;
+
+namespace ke
+{
+	inline size_t SafeVsprintf(char *buffer, size_t maxlength, const char *fmt, va_list ap)
+	{
+		if (!maxlength)
+		{
+			return 0;
+		}
+		int len = vsnprintf(buffer, maxlength, fmt, ap);
+		if (len < 0)
+		{
+			buffer[0] = '\0';
+			return 0;
+		}
+		return (size_t)len >= maxlength ? maxlength - 1 : (size_t)len;
+	}
+
+	inline size_t SafeSprintf(char *buffer, size_t maxlength, const char *fmt, ...)
+	{
+		va_list ap;
+		va_start(ap, fmt);
+		size_t len = SafeVsprintf(buffer, maxlength, fmt, ap);
+		va_end(ap);
+		return len;
+	}
+
+	inline size_t SafeStrcpy(char *dest, size_t maxlength, const char *src)
+	{
+		if (!maxlength)
+		{
+			return 0;
+		}
+		size_t len = strlen(src);
+		if (len >= maxlength)
+		{
+			len = maxlength - 1;
+		}
+		memcpy(dest, src, len);
+		dest[len] = '\0';
+		return len;
+	}
+}
+
+inline cell_t sp_ftoc(float f)
+{
+	cell_t c;
+	memcpy(&c, &f, sizeof(c));
+	return c;
+}
+
+inline float sp_ctof(cell_t c)
+{
+	float f;
+	memcpy(&f, &c, sizeof(f));
+	return f;
+}
+
+namespace SourcePawn
+{
+	class IPluginContext
+	{
+	public:
+		virtual int LocalToString(cell_t local_addr, char **addr) = 0;
+		virtual int LocalToPhysAddr(cell_t local_addr, cell_t **phys_addr) = 0;
+	};
+
+	class IPluginRuntime
+	{
+	public:
+		virtual unsigned int GetMemUsage() = 0;
+	};
+
+	typedef cell_t (*SPVM_NATIVE_FUNC)(IPluginContext *, const cell_t *);
+
+	struct sp_nativeinfo_t
+	{
+		const char *name;
+		SPVM_NATIVE_FUNC func;
+	};
+}
+
+using namespace SourcePawn;
+
+namespace SourceMod
+{
+	class IExtension;
+
+	enum PathType
+	{
+		Path_None = 0,
+		Path_Game,
+		Path_SM,
+		Path_SM_Rel,
+	};
+
+	typedef void (*GAME_FRAME_HOOK)(bool simulating);
+
+	class ISourceMod
+	{
+	public:
+		virtual size_t BuildPath(PathType type, char *buffer, size_t maxlength, const char *format, ...) = 0;
+		virtual void LogMessage(IExtension *pExt, const char *format, ...) = 0;
+		virtual void LogError(IExtension *pExt, const char *format, ...) = 0;
+		virtual void AddGameFrameHook(GAME_FRAME_HOOK hook) = 0;
+		virtual void RemoveGameFrameHook(GAME_FRAME_HOOK hook) = 0;
+	};
+
+	enum PluginStatus
+	{
+		Plugin_Running = 0,
+		Plugin_Paused,
+		Plugin_Error,
+		Plugin_Loaded,
+		Plugin_Failed,
+		Plugin_Created,
+		Plugin_Uncompiled,
+		Plugin_BadLoad,
+		Plugin_Evicted,
+	};
+
+	enum PluginType
+	{
+		PluginType_Private,
+		PluginType_MapUpdated,
+		PluginType_MapOnly,
+		PluginType_Global,
+	};
+
+	class IPlugin
+	{
+	public:
+		virtual const char *GetFilename() = 0;
+		virtual PluginStatus GetStatus() = 0;
+		virtual bool SetPauseState(bool paused) = 0;
+		virtual IPluginRuntime *GetRuntime() = 0;
+	};
+
+	class IPluginIterator
+	{
+	public:
+		virtual bool MorePlugins() = 0;
+		virtual IPlugin *GetPlugin() = 0;
+		virtual void NextPlugin() = 0;
+		virtual void Release() = 0;
+	};
+
+	class IPluginsListener
+	{
+	public:
+		virtual void OnPluginCreated(IPlugin *plugin)
+		{
+		}
+		virtual void OnPluginLoaded(IPlugin *plugin)
+		{
+		}
+		virtual void OnPluginPauseChange(IPlugin *plugin, bool paused)
+		{
+		}
+		virtual void OnPluginUnloaded(IPlugin *plugin)
+		{
+		}
+		virtual void OnPluginDestroyed(IPlugin *plugin)
+		{
+		}
+	};
+
+	class IPluginManager
+	{
+	public:
+		virtual IPlugin *LoadPlugin(const char *path, bool debug, PluginType type,
+			char error[], size_t maxlength, bool *wasloaded) = 0;
+		virtual bool UnloadPlugin(IPlugin *plugin) = 0;
+		virtual IPluginIterator *GetPluginIterator() = 0;
+		virtual void AddPluginsListener(IPluginsListener *listener) = 0;
+		virtual void RemovePluginsListener(IPluginsListener *listener) = 0;
+	};
+
+	struct SMCStates
+	{
+		unsigned int line;
+		unsigned int col;
+	};
+
+	enum SMCResult
+	{
+		SMCResult_Continue,
+		SMCResult_Halt,
+		SMCResult_HaltFail,
+	};
+
+	enum SMCError
+	{
+		SMCError_Okay = 0,
+		SMCError_StreamOpen,
+		SMCError_StreamError,
+		SMCError_Custom,
+		SMCError_InvalidSection1,
+		SMCError_InvalidSection2,
+		SMCError_InvalidSection3,
+		SMCError_InvalidSection4,
+		SMCError_InvalidSection5,
+		SMCError_InvalidTokens,
+		SMCError_TokenOverflow,
+		SMCError_InvalidProperty1,
+	};
+
+	class ITextListener_SMC
+	{
+	public:
+		virtual void ReadSMC_ParseStart()
+		{
+		}
+		virtual void ReadSMC_ParseEnd(bool halted, bool failed)
+		{
+		}
+		virtual SMCResult ReadSMC_NewSection(const SMCStates *states, const char *name)
+		{
+			return SMCResult_Continue;
+		}
+		virtual SMCResult ReadSMC_KeyValue(const SMCStates *states, const char *key, const char *value)
+		{
+			return SMCResult_Continue;
+		}
+		virtual SMCResult ReadSMC_LeavingSection(const SMCStates *states)
+		{
+			return SMCResult_Continue;
+		}
+		virtual SMCResult ReadSMC_RawLine(const SMCStates *states, const char *line)
+		{
+			return SMCResult_Continue;
+		}
+	};
+
+	class ITextParsers
+	{
+	public:
+		virtual SMCError ParseSMCFile(const char *file, ITextListener_SMC *smc_listener,
+			SMCStates *states, char *buffer, size_t maxsize) = 0;
+		virtual SMCError ParseSMCStream(const char *stream, size_t length, ITextListener_SMC *smc_listener,
+			SMCStates *states, char *buffer, size_t maxsize) = 0;
+		virtual const char *GetSMCErrorString(SMCError err) = 0;
+	};
+
+	class IGameHelpers
+	{
+	public:
+		virtual void ServerCommand(const char *buffer) = 0;
+	};
+
+	enum FileTimeType
+	{
+		FileTime_LastAccess = 0,
+		FileTime_Created = 1,
+		FileTime_LastChange = 2,
+	};
+
+	class IDirectory
+	{
+	public:
+		virtual bool MoreFiles() = 0;
+		virtual void NextEntry() = 0;
+		virtual const char *GetEntryName() = 0;
+		virtual bool IsEntryDirectory() = 0;
+	};
+
+	class ILibrarySys
+	{
+	public:
+		virtual IDirectory *OpenDirectory(const char *path) = 0;
+		virtual void CloseDirectory(IDirectory *dir) = 0;
+		virtual bool FileTime(const char *path, FileTimeType type, time_t *pTime) = 0;
+	};
+
+	class ICommandArgs
+	{
+	public:
+		virtual const char *Arg(int n) const = 0;
+		virtual int ArgC() const = 0;
+	};
+
+	class IRootConsoleCommand
+	{
+	public:
+		virtual void OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args) = 0;
+	};
+
+	class IRootConsole
+	{
+	public:
+		virtual bool AddRootConsoleCommand3(const char *cmd, const char *text, IRootConsoleCommand *pHandler) = 0;
+		virtual bool RemoveRootConsoleCommand(const char *cmd, IRootConsoleCommand *pHandler) = 0;
+		virtual void ConsolePrint(const char *fmt, ...) = 0;
+	};
+
+	enum ExecType
+	{
+		ET_Ignore = 0,
+		ET_Single = 1,
+		ET_Event = 2,
+		ET_Hook = 3,
+	};
+
+	enum ParamType
+	{
+		Param_Any = 0,
+		Param_Cell,
+		Param_Float,
+		Param_String,
+		Param_Array,
+	};
+
+	class IForward
+	{
+	public:
+		virtual int PushCell(cell_t cell) = 0;
+		virtual int PushString(const char *string) = 0;
+		virtual int Execute(cell_t *result, void *filter = NULL) = 0;
+	};
+
+	class IForwardManager
+	{
+	public:
+		virtual IForward *CreateForward(const char *name, ExecType et, unsigned int num_params,
+			const ParamType *types, ...) = 0;
+		virtual void ReleaseForward(IForward *forward) = 0;
+	};
+
+	class IShareSys
+	{
+	public:
+		virtual void AddNatives(IExtension *myself, const sp_nativeinfo_t *natives) = 0;
+	};
+}
+
+using namespace SourceMod;
+
+struct edict_t;
+
+class SDKExtension
+{
+public:
+	virtual ~SDKExtension()
+	{
+	}
+
+	virtual bool SDK_OnLoad(char *error, size_t maxlen, bool late)
+	{
+		return true;
+	}
+	virtual void SDK_OnUnload()
+	{
+	}
+	virtual void SDK_OnAllLoaded()
+	{
+	}
+	virtual bool QueryRunning(char *error, size_t maxlen)
+	{
+		return true;
+	}
+	virtual void OnCoreMapStart(edict_t *pEdictList, int edictCount, int clientMax)
+	{
+	}
+	virtual void OnCoreMapEnd()
+	{
+	}
+};
+
+extern ISourceMod *g_pSM;
+extern ISourceMod *smutils;
+extern IExtension *myself;
+extern IPluginManager *plsys;
+extern ITextParsers *textparsers;
+extern IGameHelpers *gamehelpers;
+extern ILibrarySys *libsys;
+extern IRootConsole *rootconsole;
+extern IForwardManager *forwards;
+extern IShareSys *sharesys;
+
+#endif // _INCLUDE_MODEGROUP_BENCH_SMSDK_EXT_H_
@@ -13,6 +13,8 @@ parser.options.add_argument('--enable-debug', action='store_const', const='1', d
                        help='Enable debugging symbols')
 parser.options.add_argument('--enable-optimize', action='store_const', const='1', dest='opt',
                        help='Enable optimization')
+parser.options.add_argument('--enable-bench', action='store_const', const='1', dest='bench',
+                       help='Build the host-side switch benchmark (bench/)')
 parser.options.add_argument('--targets', type=str, dest='targets', default=None,
                           help="Override the target architecture (use commas to separate multiple targets).")
 parser.Configure()
\ No newline at end of file
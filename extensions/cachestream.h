@@ -0,0 +1,204 @@
+#ifndef _INCLUDE_MODEGROUP_CACHESTREAM_H_
+#define _INCLUDE_MODEGROUP_CACHESTREAM_H_
+
+/**
+ * @file cachestream.h
+ * @brief Serialization helpers for the extension's binary files in data/.
+ */
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+class CacheWriter
+{
+public:
+	void U8(uint8_t v)
+	{
+		m_Data.push_back((char)v);
+	}
+	void U32(uint32_t v)
+	{
+		m_Data.append((const char *)&v, sizeof(v));
+	}
+	void U64(uint64_t v)
+	{
+		m_Data.append((const char *)&v, sizeof(v));
+	}
+	void F32(float v)
+	{
+		m_Data.append((const char *)&v, sizeof(v));
+	}
+	void Str(const std::string &s)
+	{
+		U32((uint32_t)s.size());
+		m_Data.append(s);
+	}
+	void Str(const char *s, size_t length)
+	{
+		U32((uint32_t)length);
+		m_Data.append(s, length);
+	}
+	void Bytes(const void *data, size_t size)
+	{
+		m_Data.append((const char *)data, size);
+	}
+	/**
+	 * Pads with zeros to a multiple of alignment, counted from the start.
+	 */
+	void Align(size_t alignment)
+	{
+		m_Data.append((alignment - m_Data.size() % alignment) % alignment, '\0');
+	}
+	void List(const std::vector<std::string> &list)
+	{
+		U32((uint32_t)list.size());
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			Str(list[i]);
+		}
+	}
+
+	const std::string &Data() const
+	{
+		return m_Data;
+	}
+
+private:
+	std::string m_Data;
+};
+
+class CacheReader
+{
+public:
+	CacheReader(const char *data, size_t length) : m_Start(data), m_Pos(data), m_End(data + length), m_Failed(false)
+	{
+	}
+
+	bool Failed() const
+	{
+		return m_Failed;
+	}
+	bool AtEnd() const
+	{
+		return m_Pos == m_End;
+	}
+	void Fail()
+	{
+		m_Failed = true;
+	}
+
+	uint8_t U8()
+	{
+		uint8_t v = 0;
+		Raw(&v, sizeof(v));
+		return v;
+	}
+	uint32_t U32()
+	{
+		uint32_t v = 0;
+		Raw(&v, sizeof(v));
+		return v;
+	}
+	uint64_t U64()
+	{
+		uint64_t v = 0;
+		Raw(&v, sizeof(v));
+		return v;
+	}
+	float F32()
+	{
+		float v = 0.0f;
+		Raw(&v, sizeof(v));
+		return v;
+	}
+	void Str(std::string &s)
+	{
+		uint32_t len = U32();
+		if (m_Failed || len > (size_t)(m_End - m_Pos))
+		{
+			m_Failed = true;
+			return;
+		}
+		s.assign(m_Pos, len);
+		m_Pos += len;
+	}
+	/**
+	 * Returns a string without copying it; it points into the input.
+	 */
+	void Str(const char *&s, uint32_t &length)
+	{
+		length = U32();
+		if (m_Failed || length > (size_t)(m_End - m_Pos))
+		{
+			m_Failed = true;
+			length = 0;
+			s = "";
+			return;
+		}
+		s = m_Pos;
+		m_Pos += length;
+	}
+	void Bytes(void *out, size_t size)
+	{
+		Raw(out, size);
+	}
+	/**
+	 * Returns the next size bytes without copying them, NULL when the input
+	 * is too short.
+	 */
+	const char *View(size_t size)
+	{
+		if (m_Failed || size > (size_t)(m_End - m_Pos))
+		{
+			m_Failed = true;
+			return NULL;
+		}
+		const char *p = m_Pos;
+		m_Pos += size;
+		return p;
+	}
+	/**
+	 * Skips the padding written by CacheWriter::Align().
+	 */
+	void Align(size_t alignment)
+	{
+		View((alignment - (size_t)(m_Pos - m_Start) % alignment) % alignment);
+	}
+	void List(std::vector<std::string> &list)
+	{
+		uint32_t count = U32();
+		for (uint32_t i = 0; i < count && !m_Failed; i++)
+		{
+			list.push_back(std::string());
+			Str(list.back());
+		}
+	}
+
+private:
+	void Raw(void *out, size_t size)
+	{
+		if (m_Failed || size > (size_t)(m_End - m_Pos))
+		{
+			m_Failed = true;
+			return;
+		}
+		memcpy(out, m_Pos, size);
+		m_Pos += size;
+	}
+
+private:
+	const char *m_Start;
+	const char *m_Pos;
+	const char *m_End;
+	bool m_Failed;
+};
+
+/**
+ * Writes a header and payload to a temporary file and renames it over path,
+ * so readers never see a half written file.
+ */
+bool WriteCacheFile(const char *path, const void *header, size_t headerSize, const std::string &payload);
+
+#endif // _INCLUDE_MODEGROUP_CACHESTREAM_H_
@@ -0,0 +1,262 @@
+#include "configcache.h"
+#include "mappedfile.h"
+#include "cachestream.h"
+#include <cstdio>
+#include <memory>
+
+#if defined PLATFORM_WINDOWS
+#include <windows.h>
+#endif
+
+#define CONFIG_CACHE_MAGIC		0x4343474D // "MGCC"
+#define CONFIG_CACHE_VERSION	6
+
+/**
+ * Layout, all integers little endian as written by this machine:
+ *   header
+ *   settings
+ *   u32 string count, then every string of the pool in ID order from ID 1
+ *   padding to 4 bytes, u32 ID count, then the ID arena
+ *   u32 group count
+ *   per group: u32 name, u32 plugin_directory, u8 use_sm_cvar, u8 suspend_on_leave,
+ *              load_plugins, unload_plugins, cvars, commands as (u32 offset, u32 count)
+ * Strings are a u32 length, the u32 pool hash, then the bytes and a NUL, so
+ * Read() can point the pool and the ID arena into the mapped file.
+ */
+struct ConfigCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_hash;
+	uint64_t payload_size;
+	uint64_t payload_hash;
+};
+
+bool WriteCacheFile(const char *path, const void *header, size_t headerSize, const std::string &payload)
+{
+	// 先写临时文件再改名, 服务器崩溃也不会留下写了一半的缓存
+	std::string tmpPath = std::string(path) + ".tmp";
+	FILE *fp = fopen(tmpPath.c_str(), "wb");
+	if (!fp)
+	{
+		return false;
+	}
+
+	bool ok = fwrite(header, headerSize, 1, fp) == 1
+		&& fwrite(payload.data(), 1, payload.size(), fp) == payload.size();
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok)
+	{
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	// 直接覆盖旧文件, 任何时候打开的都是完整的旧文件或新文件
+#if defined PLATFORM_WINDOWS
+	// Windows 上 rename() 不能覆盖已有的文件
+	return MoveFileExA(tmpPath.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(tmpPath.c_str(), path) == 0;
+#endif
+}
+
+uint64_t ConfigCache::Hash(const void *data, size_t length, uint64_t hash)
+{
+	// FNV-1a
+	const unsigned char *p = (const unsigned char *)data;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void WriteSpan(CacheWriter &w, IdSpan span)
+{
+	w.U32(span.offset);
+	w.U32(span.count);
+}
+
+static IdSpan ReadSpan(CacheReader &r, size_t idCount)
+{
+	IdSpan span;
+	span.offset = r.U32();
+	span.count = r.U32();
+	if ((uint64_t)span.offset + span.count > idCount)
+	{
+		r.Fail();
+		return IdSpan();
+	}
+	return span;
+}
+
+bool ConfigCache::Write(const char *path, uint64_t sourceHash,
+	const ModeGroupTable &groups, const ModeGroupSettings &settings)
+{
+	CacheWriter w;
+	// lazy_parse 打开时不写缓存, 这一项不保存
+	w.U8(settings.incremental_switch ? 1 : 0);
+	w.F32(settings.frame_budget_ms);
+	w.F32(settings.prepare_timeout);
+	w.U8(settings.prepare_mlock ? 1 : 0);
+	w.U64(settings.prepare_memory_cap);
+	w.F32(settings.switch_debounce_ms);
+	w.U64(settings.suspend_memory_cap);
+
+	// 字符串池和 ID 数组原样写出, 读的时候不用再排序和去重
+	const StringPool &strings = groups.m_Strings;
+	w.U32((uint32_t)strings.Count());
+	for (StringId id = 1; id < strings.Count(); id++)
+	{
+		w.U32((uint32_t)strings.GetLength(id));
+		w.U32(strings.GetHash(id));
+		w.Bytes(strings.Get(id), strings.GetLength(id) + 1);
+	}
+
+	// 头部 32 字节, 映射从页边界开始, 按载荷对齐就能直接当 StringId 数组用
+	const StringId *ids = groups.GetIds(IdSpan());
+	size_t idCount = groups.m_IdView ? groups.m_IdViewCount : groups.m_Ids.size();
+	w.Align(sizeof(StringId));
+	w.U32((uint32_t)idCount);
+	w.Bytes(ids, idCount * sizeof(StringId));
+
+	w.U32((uint32_t)groups.Count());
+	for (size_t i = 0; i < groups.Count(); i++)
+	{
+		const ModeGroup &group = groups.Get(i);
+		w.U32(group.name);
+		w.U32(group.plugin_directory);
+		w.U8(group.use_sm_cvar ? 1 : 0);
+		w.U8(group.suspend_on_leave ? 1 : 0);
+		WriteSpan(w, group.load_plugins);
+		WriteSpan(w, group.unload_plugins);
+		WriteSpan(w, group.cvars);
+		WriteSpan(w, group.commands);
+	}
+
+	ConfigCacheHeader header;
+	header.magic = CONFIG_CACHE_MAGIC;
+	header.version = CONFIG_CACHE_VERSION;
+	header.source_hash = sourceHash;
+	header.payload_size = w.Data().size();
+	header.payload_hash = Hash(w.Data().data(), w.Data().size());
+
+	return WriteCacheFile(path, &header, sizeof(header), w.Data());
+}
+
+bool ConfigCache::Read(const char *path, uint64_t sourceHash,
+	ModeGroupTable &groups, ModeGroupSettings &settings)
+{
+	// 读成功后表继续引用这个映射, 字符串和 ID 数组都不复制
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+	if (!file->Open(path) || file->GetSize() < sizeof(ConfigCacheHeader))
+	{
+		return false;
+	}
+
+	ConfigCacheHeader header;
+	memcpy(&header, file->GetData(), sizeof(header));
+
+	const char *payload = file->GetData() + sizeof(header);
+	size_t payloadSize = file->GetSize() - sizeof(header);
+
+	if (header.magic != CONFIG_CACHE_MAGIC
+		|| header.version != CONFIG_CACHE_VERSION
+		|| header.source_hash != sourceHash
+		|| header.payload_size != payloadSize
+		|| header.payload_hash != Hash(payload, payloadSize))
+	{
+		return false;
+	}
+
+	groups.Clear();
+
+	CacheReader r(payload, payloadSize);
+	settings.incremental_switch = r.U8() != 0;
+	settings.frame_budget_ms = r.F32();
+	settings.prepare_timeout = r.F32();
+	settings.prepare_mlock = r.U8() != 0;
+	settings.prepare_memory_cap = (size_t)r.U64();
+	settings.switch_debounce_ms = r.F32();
+	settings.suspend_memory_cap = (size_t)r.U64();
+
+	// 池里的字符串互不相同, 按顺序放入后 ID 和写入时一样; 字符串留在映射里
+	// 每个字符串至少占 9 字节 (长度, 哈希和结尾的 NUL)
+	uint32_t stringCount = r.U32();
+	if (!r.Failed() && stringCount <= payloadSize / 9)
+	{
+		groups.m_Strings.Reserve(stringCount);
+	}
+	else
+	{
+		r.Fail();
+	}
+
+	for (uint32_t id = 1; id < stringCount && !r.Failed(); id++)
+	{
+		uint32_t length = r.U32();
+		uint32_t hash = r.U32();
+		const char *str = r.View((size_t)length + 1);
+		if (!str || str[length] != '\0')
+		{
+			r.Fail();
+			break;
+		}
+		groups.m_Strings.AddExternal(str, length, hash);
+	}
+
+	r.Align(sizeof(StringId));
+	uint32_t idCount = r.U32();
+	const char *ids = idCount <= payloadSize / sizeof(StringId) ? r.View(idCount * sizeof(StringId)) : NULL;
+	if (ids && (uintptr_t)ids % alignof(StringId) == 0)
+	{
+		groups.m_IdView = (const StringId *)ids;
+		groups.m_IdViewCount = idCount;
+	}
+	else
+	{
+		r.Fail();
+	}
+
+	for (size_t i = 0; i < groups.m_IdViewCount && !r.Failed(); i++)
+	{
+		if (groups.m_IdView[i] >= stringCount)
+		{
+			r.Fail();
+		}
+	}
+
+	uint32_t count = r.U32();
+	for (uint32_t i = 0; i < count && !r.Failed(); i++)
+	{
+		ModeGroup group;
+		group.name = r.U32();
+		group.plugin_directory = r.U32();
+		group.use_sm_cvar = r.U8() != 0;
+		group.suspend_on_leave = r.U8() != 0;
+		group.load_plugins = ReadSpan(r, idCount);
+		group.unload_plugins = ReadSpan(r, idCount);
+		group.cvars = ReadSpan(r, idCount);
+		group.commands = ReadSpan(r, idCount);
+
+		if (group.name == 0 || group.name >= stringCount || group.plugin_directory >= stringCount
+			|| group.cvars.count % 2 != 0 || group.commands.count % 2 != 0)
+		{
+			r.Fail();
+			break;
+		}
+
+		groups.Add(group);
+	}
+
+	if (r.Failed() || !r.AtEnd())
+	{
+		groups.Clear();
+		settings = ModeGroupSettings();
+		return false;
+	}
+
+	groups.m_Mapping = file;
+	return true;
+}
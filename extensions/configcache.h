@@ -0,0 +1,40 @@
+#ifndef _INCLUDE_MODEGROUP_CONFIGCACHE_H_
+#define _INCLUDE_MODEGROUP_CONFIGCACHE_H_
+
+/**
+ * @file configcache.h
+ * @brief Binary cache of the parsed mode group table.
+ */
+
+#include "extension.h"
+
+/**
+ * Stores the parsed group table in data/modegroup.cache so startup can skip
+ * the ConfigReader parse of modegroup.cfg. The cache is tied to the FNV-1a hash of the
+ * cfg it was built from and is ignored as soon as the hash, the format
+ * version or its own checksum does not match.
+ */
+class ConfigCache
+{
+public:
+	static bool Write(const char *path, uint64_t sourceHash,
+		const ModeGroupTable &groups, const ModeGroupSettings &settings);
+
+	/**
+	 * Memory-maps the cache and points the table's strings and ID arena into
+	 * the mapping, which the table keeps open; only the group records and
+	 * lookup tables are built. Returns false, leaving the table empty, if the
+	 * cache is missing, stale or damaged.
+	 *
+	 * The cache is only ever replaced by renaming a new file over it, never
+	 * rewritten in place, so a mapping held by a live table stays valid. On
+	 * Windows a mapped file cannot be replaced; Write() then fails until the
+	 * table holding it is released.
+	 */
+	static bool Read(const char *path, uint64_t sourceHash,
+		ModeGroupTable &groups, ModeGroupSettings &settings);
+
+	static uint64_t Hash(const void *data, size_t length, uint64_t hash = 14695981039346656037ULL);
+};
+
+#endif // _INCLUDE_MODEGROUP_CONFIGCACHE_H_
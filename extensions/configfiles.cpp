@@ -0,0 +1,242 @@
+#include "configfiles.h"
+#include "configcache.h"
+#include <algorithm>
+#include <unordered_map>
+
+#define CONFIG_MAX_THREADS	4
+
+bool ReadConfigFile(const char *path, std::string &data)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+	{
+		return false;
+	}
+
+	data.clear();
+	char buffer[16384];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+	{
+		data.append(buffer, read);
+	}
+
+	bool failed = ferror(fp) != 0;
+	fclose(fp);
+	return !failed;
+}
+
+ConfigFile::ConfigFile()
+	: mtime(0), checkedAt(0), hash(0), has_settings(false), parsed(false), error(SMCError_Okay)
+{
+	states.line = 0;
+	states.col = 0;
+}
+
+ConfigDirectory::ConfigDirectory() : m_Lazy(false), m_Next(0), m_Parser(NULL)
+{
+}
+
+void ConfigDirectory::Clear()
+{
+	m_Files.clear();
+	m_Pending.clear();
+}
+
+bool ConfigDirectory::List(const char *path)
+{
+	std::vector<std::string> names;
+
+	IDirectory *dir = libsys->OpenDirectory(path);
+	if (dir)
+	{
+		while (dir->MoreFiles())
+		{
+			const char *name = dir->GetEntryName();
+			size_t len = strlen(name);
+			if (!dir->IsEntryDirectory() && len > 4 && strcasecmp(name + len - 4, ".cfg") == 0)
+			{
+				names.push_back(name);
+			}
+			dir->NextEntry();
+		}
+		libsys->CloseDirectory(dir);
+	}
+
+	// 按文件名排序, 合并的顺序和目录的列出顺序无关
+	std::sort(names.begin(), names.end());
+
+	std::unordered_map<std::string, size_t> oldIndex;
+	for (size_t i = 0; i < m_Files.size(); i++)
+	{
+		oldIndex[m_Files[i].name] = i;
+	}
+
+	bool changed = (names.size() != m_Files.size());
+	time_t now = time(NULL);
+	std::vector<ConfigFile> files(names.size());
+	m_Pending.clear();
+
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		ConfigFile &file = files[i];
+		std::unordered_map<std::string, size_t>::iterator it = oldIndex.find(names[i]);
+		if (it != oldIndex.end())
+		{
+			file = std::move(m_Files[it->second]);
+		}
+		else
+		{
+			char filePath[PLATFORM_MAX_PATH];
+			ke::SafeSprintf(filePath, sizeof(filePath), "%s/%s", path, names[i].c_str());
+			file.name = names[i];
+			file.path = filePath;
+			changed = true;
+		}
+
+		time_t mtime = 0;
+		libsys->FileTime(file.path.c_str(), FileTime_LastChange, &mtime);
+
+		// mtime 只精确到秒, 和上次检查在同一秒内的修改不能信任
+		if (!file.groups || file.mtime != mtime || file.checkedAt <= mtime)
+		{
+			file.mtime = mtime;
+			m_Pending.push_back(i);
+		}
+		file.checkedAt = now;
+	}
+
+	m_Files.swap(files);
+
+	return changed;
+}
+
+bool ConfigDirectory::Parse(ConfigFileParser parser, bool lazy)
+{
+	m_Reading.clear();
+	for (size_t i = 0; i < m_Files.size(); i++)
+	{
+		m_Files[i].parsed = false;
+	}
+
+	if (lazy != m_Lazy)
+	{
+		// 解析方式变了, 所有文件都要重新解析
+		m_Lazy = lazy;
+		for (size_t i = 0; i < m_Files.size(); i++)
+		{
+			m_Files[i].groups.reset();
+			m_Reading.push_back(&m_Files[i]);
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < m_Pending.size(); i++)
+		{
+			m_Reading.push_back(&m_Files[m_Pending[i]]);
+		}
+	}
+	m_Pending.clear();
+
+	if (m_Reading.empty())
+	{
+		return false;
+	}
+
+	m_Parser = parser;
+	m_Next = 0;
+
+	size_t threads = std::thread::hardware_concurrency();
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+	if (threads > CONFIG_MAX_THREADS)
+	{
+		threads = CONFIG_MAX_THREADS;
+	}
+	if (threads > m_Reading.size())
+	{
+		threads = m_Reading.size();
+	}
+
+	// 只改了一个文件时直接在当前线程解析, 不开线程
+	if (threads == 1)
+	{
+		Worker();
+	}
+	else
+	{
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < threads; i++)
+		{
+			workers.push_back(std::thread(&ConfigDirectory::Worker, this));
+		}
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+	}
+
+	bool changed = false;
+	for (size_t i = 0; i < m_Reading.size(); i++)
+	{
+		if (m_Reading[i]->parsed)
+		{
+			changed = true;
+		}
+	}
+	m_Reading.clear();
+
+	return changed;
+}
+
+void ConfigDirectory::Worker()
+{
+	for (;;)
+	{
+		size_t index = m_Next.fetch_add(1);
+		if (index >= m_Reading.size())
+		{
+			break;
+		}
+
+		Load(*m_Reading[index]);
+	}
+}
+
+void ConfigDirectory::Load(ConfigFile &file)
+{
+	std::string data;
+	if (!ReadConfigFile(file.path.c_str(), data))
+	{
+		file.groups.reset(new ModeGroupTable());
+		file.hash = 0;
+		file.has_settings = false;
+		file.parsed = true;
+		file.error = SMCError_StreamOpen;
+		file.states.line = 0;
+		file.states.col = 0;
+		return;
+	}
+
+	// 只是被 touch 过, 内容没变的文件沿用原来的表
+	uint64_t hash = ConfigCache::Hash(data.data(), data.size());
+	if (file.groups && file.error == SMCError_Okay && hash == file.hash)
+	{
+		return;
+	}
+
+	file.groups.reset(new ModeGroupTable());
+	file.hash = hash;
+	file.has_settings = false;
+	file.parsed = true;
+	file.error = SMCError_Okay;
+	file.states.line = 0;
+	file.states.col = 0;
+
+	if (!data.empty())
+	{
+		m_Parser(file, data.data(), data.size(), m_Lazy);
+	}
+}
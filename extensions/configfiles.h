@@ -0,0 +1,109 @@
+#ifndef _INCLUDE_MODEGROUP_CONFIGFILES_H_
+#define _INCLUDE_MODEGROUP_CONFIGFILES_H_
+
+/**
+ * @file configfiles.h
+ * @brief Per-file mode group tables of the configs/modegroups directory.
+ */
+
+#include "smsdk_ext.h"
+#include "grouptable.h"
+#include <ITextParsers.h>
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * One .cfg file of the directory and the groups parsed from it.
+ */
+struct ConfigFile
+{
+	ConfigFile();
+
+	std::string name;  // file name inside the directory
+	std::string path;
+	time_t mtime;
+	time_t checkedAt;  // when mtime was last compared
+	uint64_t hash;     // of the contents the table was parsed from
+	std::unique_ptr<ModeGroupTable> groups;
+	bool has_settings; // the file has a "Settings" section
+	bool parsed;       // the table was rebuilt by the last Parse()
+	SMCError error;
+	SMCStates states;
+};
+
+/**
+ * Reads a whole config file into data. Config files are copied rather than
+ * mapped: they are edited while the server runs, and a mapping of a file
+ * that is truncated under it faults on the next access.
+ */
+bool ReadConfigFile(const char *path, std::string &data);
+
+/**
+ * Parses the contents of a file into file.groups and sets has_settings,
+ * error and states. Runs on a worker thread, so it must not call into
+ * SourceMod.
+ */
+typedef void (*ConfigFileParser)(ConfigFile &file, const char *data, size_t length, bool lazy);
+
+/**
+ * Keeps a table for every .cfg file in a directory. A file whose mtime did
+ * not change is not opened again, and one that was touched but still hashes
+ * the same keeps its table, so editing one file only parses that file.
+ * Files that do need parsing are spread over a few worker threads.
+ *
+ * List() and Clear() are called from the main thread. Parse() makes no
+ * SourceMod calls and may run on another thread, as long as nothing else
+ * uses the object until it returns.
+ */
+class ConfigDirectory
+{
+public:
+	ConfigDirectory();
+
+	/**
+	 * Lists the .cfg files of the directory in name order and notes the new
+	 * ones and those with a new mtime. A missing directory has no files.
+	 * Returns true if files were added or removed since the last call.
+	 */
+	bool List(const char *path);
+
+	/**
+	 * Parses the files noted by List(), or every file if lazy differs from
+	 * the last call. Returns true if any table was rebuilt.
+	 */
+	bool Parse(ConfigFileParser parser, bool lazy);
+
+	size_t Count() const
+	{
+		return m_Files.size();
+	}
+	const ConfigFile &Get(size_t index) const
+	{
+		return m_Files[index];
+	}
+
+	/**
+	 * Forgets every file, the next List() and Parse() read all of them again.
+	 */
+	void Clear();
+
+private:
+	void Worker();
+	void Load(ConfigFile &file);
+
+private:
+	std::vector<ConfigFile> m_Files;
+	bool m_Lazy;
+
+	// files picked by List(), parsed by the next Parse()
+	std::vector<size_t> m_Pending;
+	std::vector<ConfigFile *> m_Reading;
+	std::atomic<size_t> m_Next;
+	ConfigFileParser m_Parser;
+};
+
+#endif // _INCLUDE_MODEGROUP_CONFIGFILES_H_
@@ -0,0 +1,218 @@
+#include "configindex.h"
+#include <cstring>
+
+enum SectionKind
+{
+	Section_Other = 0,
+	Section_Settings,
+	Section_ModeGroups,
+	Section_Group,
+	Section_Body, // anything inside a group
+};
+
+struct OpenSection
+{
+	SectionKind kind;
+	ConfigSection section;
+};
+
+static bool IsTokenEnd(const char *p, const char *end)
+{
+	char c = *p;
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '{' || c == '}' || c == '"'
+		|| (c == '/' && p + 1 < end && (p[1] == '/' || p[1] == '*'));
+}
+
+static bool IsName(const char *str, size_t length, const char *name)
+{
+	return length == strlen(name) && memcmp(str, name, length) == 0;
+}
+
+bool ConfigIndex::Scan(const char *data, size_t length,
+	std::vector<ConfigSection> &settings, std::vector<ConfigSection> &groups)
+{
+	const char *p = data;
+	const char *end = data + length;
+	uint32_t line = 1;
+	const char *lineStart = p;
+	std::vector<OpenSection> stack;
+
+	// 上一个还没配对的字符串, 后面跟 { 就是段名
+	bool haveToken = false;
+	const char *tokenStart = NULL;
+	size_t tokenLength = 0;
+	uint32_t tokenOffset = 0;
+	uint32_t tokenLine = 0;
+	uint32_t tokenCol = 0;
+	bool tokenEscaped = false;
+
+	if (length >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+	{
+		p += 3;
+		lineStart = p;
+	}
+
+	while (p < end)
+	{
+		char c = *p;
+		if (c == '\n')
+		{
+			line++;
+			p++;
+			lineStart = p;
+			continue;
+		}
+		if (c == ' ' || c == '\t' || c == '\r')
+		{
+			p++;
+			continue;
+		}
+		if (c == '/' && p + 1 < end && p[1] == '/')
+		{
+			while (p < end && *p != '\n')
+			{
+				p++;
+			}
+			continue;
+		}
+		if (c == '/' && p + 1 < end && p[1] == '*')
+		{
+			for (p += 2; p + 1 < end && !(p[0] == '*' && p[1] == '/'); p++)
+			{
+				if (*p == '\n')
+				{
+					line++;
+					lineStart = p + 1;
+				}
+			}
+			if (p + 1 >= end)
+			{
+				return false;
+			}
+			p += 2;
+			continue;
+		}
+
+		if (c == '{')
+		{
+			if (!haveToken)
+			{
+				return false;
+			}
+			haveToken = false;
+
+			SectionKind parent = stack.empty() ? Section_Other : stack.back().kind;
+			OpenSection open;
+			if (parent == Section_Group || parent == Section_Body)
+			{
+				open.kind = Section_Body;
+			}
+			else if (parent == Section_ModeGroups)
+			{
+				open.kind = Section_Group;
+			}
+			else if (IsName(tokenStart, tokenLength, "ModeGroups"))
+			{
+				open.kind = Section_ModeGroups;
+			}
+			else if (IsName(tokenStart, tokenLength, "Settings"))
+			{
+				open.kind = Section_Settings;
+			}
+			else
+			{
+				open.kind = Section_Other;
+			}
+
+			// 分组内部的段不需要名字, 不为它们分配字符串
+			if (open.kind == Section_Group || open.kind == Section_Settings)
+			{
+				open.section.name.assign(tokenStart, tokenLength);
+			}
+			open.section.offset = tokenOffset;
+			open.section.length = 0;
+			open.section.line = tokenLine;
+			open.section.col = tokenCol;
+			open.section.escaped = tokenEscaped;
+			stack.push_back(open);
+			p++;
+			continue;
+		}
+
+		if (c == '}')
+		{
+			if (haveToken || stack.empty())
+			{
+				return false;
+			}
+
+			OpenSection &open = stack.back();
+			open.section.length = (uint32_t)(p + 1 - data) - open.section.offset;
+			if (open.kind == Section_Group)
+			{
+				groups.push_back(open.section);
+			}
+			else if (open.kind == Section_Settings)
+			{
+				settings.push_back(open.section);
+			}
+			stack.pop_back();
+			p++;
+			continue;
+		}
+
+		uint32_t offset = (uint32_t)(p - data);
+		const char *start;
+		size_t tokenSize;
+		bool escaped = false;
+		if (c == '"')
+		{
+			start = ++p;
+			while (p < end && *p != '"')
+			{
+				if (*p == '\\')
+				{
+					escaped = true;
+					p++;
+				}
+				if (p >= end || *p == '\n')
+				{
+					return false;
+				}
+				p++;
+			}
+			if (p >= end)
+			{
+				return false;
+			}
+			tokenSize = p - start;
+			p++;
+		}
+		else
+		{
+			start = p;
+			while (p < end && !IsTokenEnd(p, end))
+			{
+				p++;
+			}
+			tokenSize = p - start;
+		}
+
+		// 第二个字符串是键值对的值
+		if (haveToken)
+		{
+			haveToken = false;
+			continue;
+		}
+
+		haveToken = true;
+		tokenStart = start;
+		tokenLength = tokenSize;
+		tokenOffset = offset;
+		tokenLine = line;
+		tokenCol = (uint32_t)(data + offset - lineStart) + 1;
+		tokenEscaped = escaped;
+	}
+
+	return stack.empty() && !haveToken;
+}
@@ -0,0 +1,41 @@
+#ifndef _INCLUDE_MODEGROUP_CONFIGINDEX_H_
+#define _INCLUDE_MODEGROUP_CONFIGINDEX_H_
+
+/**
+ * @file configindex.h
+ * @brief Byte ranges of the sections of modegroup.cfg, found without parsing.
+ */
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * A section of the config, from the first character of its name to its
+ * closing brace. The range can be handed to ConfigReader on its own.
+ */
+struct ConfigSection
+{
+	std::string name;
+	uint32_t offset;
+	uint32_t length;
+	uint32_t line;
+	uint32_t col;     // of the first character of the name, counted like SMCStates
+	bool escaped; // the quoted name has backslash escapes, name is not decoded
+};
+
+class ConfigIndex
+{
+public:
+	/**
+	 * Finds the "Settings" sections and every group in "ModeGroups" in one
+	 * pass that only looks at strings, comments and braces, so the cost
+	 * barely depends on what the groups contain. Returns false if the
+	 * structure does not balance; parsing the file with ConfigReader then
+	 * reports the error.
+	 */
+	static bool Scan(const char *data, size_t length,
+		std::vector<ConfigSection> &settings, std::vector<ConfigSection> &groups);
+};
+
+#endif // _INCLUDE_MODEGROUP_CONFIGINDEX_H_
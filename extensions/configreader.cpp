@@ -0,0 +1,251 @@
+#include "configreader.h"
+#include <cstring>
+
+ConfigReader::ConfigReader() : m_NextScratch(0)
+{
+}
+
+static bool IsTokenEnd(const char *p, const char *end)
+{
+	char c = *p;
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '{' || c == '}' || c == '"'
+		|| (c == '/' && p + 1 < end && (p[1] == '/' || p[1] == '*'));
+}
+
+bool ConfigReader::ReadQuoted(const char *&p, const char *end, ConfigString &token)
+{
+	// p 指向开头的引号之后
+	const char *start = p;
+	while (p < end && *p != '"' && *p != '\\' && *p != '\n')
+	{
+		p++;
+	}
+
+	if (p < end && *p == '"')
+	{
+		// 没有转义, 直接指向原文
+		token.str = start;
+		token.length = p - start;
+		p++;
+		return true;
+	}
+
+	std::string &scratch = m_Scratch[m_NextScratch];
+	m_NextScratch ^= 1;
+	scratch.assign(start, p - start);
+
+	while (p < end && *p != '"' && *p != '\n')
+	{
+		if (*p != '\\' || p + 1 >= end || p[1] == '\n')
+		{
+			scratch += *p++;
+			continue;
+		}
+
+		switch (p[1])
+		{
+		case 'n':
+			scratch += '\n';
+			break;
+		case 'r':
+			scratch += '\r';
+			break;
+		case 't':
+			scratch += '\t';
+			break;
+		case '\\':
+		case '"':
+			scratch += p[1];
+			break;
+		default:
+			// 和 SMC 一样, 不认识的转义去掉反斜杠, 只留后面的字符
+			scratch += p[1];
+			break;
+		}
+		p += 2;
+	}
+
+	if (p >= end || *p != '"')
+	{
+		return false;
+	}
+
+	token.str = scratch.data();
+	token.length = scratch.size();
+	p++;
+	return true;
+}
+
+SMCError ConfigReader::Parse(const char *data, size_t length, ConfigReaderListener *listener, SMCStates *states)
+{
+	const char *p = data;
+	const char *end = data + length;
+	const char *lineStart = p;
+	unsigned int line = 1;
+	unsigned int depth = 0;
+
+	ConfigString key;
+	bool haveKey = false;
+	const char *keyPos = NULL;
+	unsigned int keyLine = 0;
+	const char *keyLineStart = NULL;
+
+	SMCError err = SMCError_Okay;
+	const char *errPos = NULL;
+
+	if (length >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+	{
+		p += 3;
+		lineStart = p;
+	}
+
+	while (p < end)
+	{
+		char c = *p;
+		if (c == '\n')
+		{
+			p++;
+			line++;
+			lineStart = p;
+			continue;
+		}
+		if (c == ' ' || c == '\t' || c == '\r')
+		{
+			p++;
+			continue;
+		}
+		if (c == '/' && p + 1 < end && p[1] == '/')
+		{
+			while (p < end && *p != '\n')
+			{
+				p++;
+			}
+			continue;
+		}
+		if (c == '/' && p + 1 < end && p[1] == '*')
+		{
+			const char *commentPos = p;
+			unsigned int commentLine = line;
+			const char *commentLineStart = lineStart;
+			for (p += 2; p < end && !(p[0] == '*' && p + 1 < end && p[1] == '/'); p++)
+			{
+				if (*p == '\n')
+				{
+					line++;
+					lineStart = p + 1;
+				}
+			}
+			if (p >= end)
+			{
+				// 注释没有结束, 报在开头的 /* 上
+				err = SMCError_InvalidTokens;
+				errPos = commentPos;
+				line = commentLine;
+				lineStart = commentLineStart;
+				break;
+			}
+			p += 2;
+			continue;
+		}
+
+		if (c == '{')
+		{
+			if (!haveKey)
+			{
+				err = SMCError_InvalidSection2;
+				errPos = p;
+				break;
+			}
+			listener->OnSection(key);
+			haveKey = false;
+			depth++;
+			p++;
+			continue;
+		}
+
+		if (c == '}')
+		{
+			if (haveKey)
+			{
+				err = SMCError_InvalidSection3;
+				errPos = p;
+				break;
+			}
+			if (depth == 0)
+			{
+				err = SMCError_InvalidSection4;
+				errPos = p;
+				break;
+			}
+			listener->OnLeavingSection();
+			depth--;
+			p++;
+			continue;
+		}
+
+		const char *tokenPos = p;
+		ConfigString token;
+		if (c == '"')
+		{
+			p++;
+			if (!ReadQuoted(p, end, token))
+			{
+				err = SMCError_InvalidTokens;
+				errPos = tokenPos;
+				break;
+			}
+		}
+		else
+		{
+			while (p < end && !IsTokenEnd(p, end))
+			{
+				p++;
+			}
+			token.str = tokenPos;
+			token.length = p - tokenPos;
+		}
+
+		if (!haveKey)
+		{
+			key = token;
+			haveKey = true;
+			keyPos = tokenPos;
+			keyLine = line;
+			keyLineStart = lineStart;
+			continue;
+		}
+
+		if (depth == 0)
+		{
+			err = SMCError_InvalidProperty1;
+			errPos = keyPos;
+			line = keyLine;
+			lineStart = keyLineStart;
+			break;
+		}
+
+		listener->OnKeyValue(key, token);
+		haveKey = false;
+	}
+
+	if (err == SMCError_Okay && haveKey)
+	{
+		err = SMCError_InvalidTokens;
+		errPos = keyPos;
+		line = keyLine;
+		lineStart = keyLineStart;
+	}
+	else if (err == SMCError_Okay && depth != 0)
+	{
+		err = SMCError_InvalidSection5;
+		errPos = end;
+	}
+
+	if (states)
+	{
+		states->line = line;
+		states->col = (unsigned int)((err != SMCError_Okay ? errPos : p) - lineStart) + 1;
+	}
+
+	return err;
+}
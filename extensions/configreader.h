@@ -0,0 +1,58 @@
+#ifndef _INCLUDE_MODEGROUP_CONFIGREADER_H_
+#define _INCLUDE_MODEGROUP_CONFIGREADER_H_
+
+/**
+ * @file configreader.h
+ * @brief Built-in reader for the SMC subset used by modegroup.cfg.
+ */
+
+#include "smsdk_ext.h"
+#include <ITextParsers.h>
+#include <string>
+
+/**
+ * A string inside the text being read, not NUL terminated. It points into
+ * the caller's buffer unless the quoted string had escapes, then into a
+ * scratch buffer of the reader that is reused two tokens later.
+ */
+struct ConfigString
+{
+	const char *str;
+	size_t length;
+};
+
+class ConfigReaderListener
+{
+public:
+	virtual void OnSection(const ConfigString &name) = 0;
+	virtual void OnKeyValue(const ConfigString &key, const ConfigString &value) = 0;
+	virtual void OnLeavingSection() = 0;
+};
+
+/**
+ * Reads quoted and bare strings, \n \r \t \\ \" escapes, // and block
+ * comments, sections and key/value pairs straight from memory, e.g. the
+ * contents of the file read in one go, and hands out views of the strings instead of
+ * copying each one into a NUL terminated buffer first. The grammar is the
+ * one ParseSMCStream() accepts: any other escape drops the backslash and
+ * keeps the character, and a block comment that is never closed is
+ * SMCError_InvalidTokens at its opening slash. Errors use the SMC error
+ * codes, with the line and column of the offending character counted the
+ * way SMCStates counts them.
+ */
+class ConfigReader
+{
+public:
+	ConfigReader();
+
+	SMCError Parse(const char *data, size_t length, ConfigReaderListener *listener, SMCStates *states);
+
+private:
+	bool ReadQuoted(const char *&p, const char *end, ConfigString &token);
+
+private:
+	std::string m_Scratch[2];
+	size_t m_NextScratch;
+};
+
+#endif // _INCLUDE_MODEGROUP_CONFIGREADER_H_
@@ -0,0 +1,125 @@
+#include "dirindex.h"
+
+PluginDirectoryIndex::PluginDirectoryIndex() : m_Generation(0)
+{
+}
+
+bool PluginDirectoryIndex::Collect(const char *path, std::vector<std::string> &plugins)
+{
+	Node *node = Refresh(path);
+	if (!node)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < node->entries.size(); i++)
+	{
+		const Entry &entry = node->entries[i];
+		if (entry.isDir)
+		{
+			Collect(entry.path.c_str(), plugins);
+		}
+		else
+		{
+			plugins.push_back(entry.path);
+		}
+	}
+
+	return true;
+}
+
+unsigned int PluginDirectoryIndex::Stamp(const char *path)
+{
+	Node *node = Refresh(path);
+	if (!node)
+	{
+		return 0;
+	}
+
+	unsigned int stamp = node->generation;
+	for (size_t i = 0; i < node->entries.size(); i++)
+	{
+		if (node->entries[i].isDir)
+		{
+			unsigned int sub = Stamp(node->entries[i].path.c_str());
+			if (sub > stamp)
+			{
+				stamp = sub;
+			}
+		}
+	}
+
+	return stamp;
+}
+
+void PluginDirectoryIndex::Clear()
+{
+	m_Nodes.clear();
+}
+
+PluginDirectoryIndex::Node *PluginDirectoryIndex::Refresh(const std::string &path)
+{
+	char fullPath[PLATFORM_MAX_PATH];
+	g_pSM->BuildPath(Path_SM, fullPath, sizeof(fullPath), "plugins/%s", path.c_str());
+
+	time_t mtime;
+	if (!libsys->FileTime(fullPath, FileTime_LastChange, &mtime))
+	{
+		m_Nodes.erase(path);
+		g_pSM->LogError(myself, "Could not open directory: %s", fullPath);
+		return NULL;
+	}
+
+	std::unordered_map<std::string, Node>::iterator it = m_Nodes.find(path);
+
+	// mtime 只精确到秒, 和上次列目录在同一秒内的修改不能信任缓存
+	if (it != m_Nodes.end() && it->second.mtime == mtime && it->second.listedAt > mtime)
+	{
+		return &it->second;
+	}
+
+	IDirectory *dir = libsys->OpenDirectory(fullPath);
+	if (!dir)
+	{
+		m_Nodes.erase(path);
+		g_pSM->LogError(myself, "Could not open directory: %s", fullPath);
+		return NULL;
+	}
+
+	Node &node = m_Nodes[path];
+	node.mtime = mtime;
+	node.listedAt = time(NULL);
+	node.generation = ++m_Generation;
+	node.entries.clear();
+
+	while (dir->MoreFiles())
+	{
+		const char *name = dir->GetEntryName();
+		bool isDir = dir->IsEntryDirectory();
+
+		if (isDir && strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+		{
+			Entry entry;
+			entry.path = path + "/" + name;
+			entry.isDir = true;
+			node.entries.push_back(entry);
+		}
+		else if (!isDir)
+		{
+			size_t len = strlen(name);
+			if (len > 4 && strcasecmp(name + len - 4, ".smx") == 0)
+			{
+				Entry entry;
+				entry.path = path + "/" + name;
+				entry.isDir = false;
+				node.entries.push_back(entry);
+			}
+		}
+
+		dir->NextEntry();
+	}
+
+	libsys->CloseDirectory(dir);
+
+	return &node;
+}
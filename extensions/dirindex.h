@@ -0,0 +1,65 @@
+#ifndef _INCLUDE_MODEGROUP_DIRINDEX_H_
+#define _INCLUDE_MODEGROUP_DIRINDEX_H_
+
+/**
+ * @file dirindex.h
+ * @brief Cached index of the plugins directory tree.
+ */
+
+#include "smsdk_ext.h"
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * Remembers the contents of every directory under plugins/ that a mode group
+ * has asked for. A directory is only listed again when its mtime changes, so
+ * collecting an unchanged subtree costs one FileTime() call per directory.
+ */
+class PluginDirectoryIndex
+{
+public:
+	PluginDirectoryIndex();
+
+	/**
+	 * Appends every .smx below plugins/<path> to the list, in the same order
+	 * a recursive directory walk would produce them.
+	 */
+	bool Collect(const char *path, std::vector<std::string> &plugins);
+
+	/**
+	 * Returns a number that changes whenever any directory below
+	 * plugins/<path> had to be listed again. Plans compare it against the
+	 * value they were built with to know when their plugin list is stale.
+	 */
+	unsigned int Stamp(const char *path);
+
+	/**
+	 * Forgets everything, the next Collect() lists the directories again.
+	 */
+	void Clear();
+
+private:
+	struct Entry
+	{
+		std::string path;
+		bool isDir;
+	};
+
+	struct Node
+	{
+		time_t mtime;
+		time_t listedAt;
+		unsigned int generation;
+		std::vector<Entry> entries;
+	};
+
+	Node *Refresh(const std::string &path);
+
+private:
+	std::unordered_map<std::string, Node> m_Nodes;
+	unsigned int m_Generation;
+};
+
+#endif // _INCLUDE_MODEGROUP_DIRINDEX_H_
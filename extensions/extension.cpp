@@ -1,7 +1,22 @@
 #include "extension.h"
+#include "configcache.h"
+#include "configindex.h"
+#include "configreader.h"
+#include "configfiles.h"
 #include <sh_string.h>
 #include <ITextParsers.h>
 #include <IGameHelpers.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdlib>
+
+// ServerCommand() 会整体放进引擎的命令缓冲区 (约 8 KB, 与其它命令共用), 放不下时整条被丢弃,
+// 所以每批远小于缓冲区, 单条超过上限的 cvar 单独一条命令
+#define CVAR_BATCH_SIZE		1024
+
+// 记住最近多少个切换请求的结果, 供 ModeGroup_GetRequestStatus 查询
+#define SWITCH_REQUEST_HISTORY	64
 
 ModeGroupExtension g_ModeGroupExtension;
 
@@ -9,25 +24,87 @@ SMEXT_LINK(&g_ModeGroupExtension);
 
 extern sp_nativeinfo_t g_Natives[];
 
-class ModeGroupConfigParser : public ITextListener_SMC
+static void OnGameFrame(bool simulating)
+{
+	g_ModeGroupExtension.OnGameFrame(simulating);
+}
+
+ModeGroupSettings::ModeGroupSettings()
+	: incremental_switch(false), frame_budget_ms(2.0f), prepare_timeout(300.0f), prepare_mlock(false),
+	prepare_memory_cap(64 * 1024 * 1024), lazy_parse(false), switch_debounce_ms(0.0f),
+	suspend_memory_cap(64 * 1024 * 1024)
+{
+}
+
+ConfigLoad::ConfigLoad()
+	: reload(false), old_hash(0), old_lazy(false), files_listed(false), changed(0), removed(0), hash(0), hashed(false),
+	cached(false), main_groups(0), unchanged(false), failed(false), error(SMCError_Okay), ms(0.0), done(false)
+{
+	error_states.line = 0;
+	error_states.col = 0;
+}
+
+PreparedGroup::PreparedGroup() : bytes(0), locked_bytes(0)
+{
+}
+
+SwitchState::SwitchState()
+	: phase(SwitchPhase_None), index(0), cvar_batches(NULL), request(0), suspend(false), cvars_failed(false)
+{
+}
+
+SwitchRequest::SwitchRequest() : id(0)
+{
+}
+
+typedef std::pair<StringId, StringId> StringIdPair;
+
+/**
+ * Stores name, value pairs in the order they were written. A name given
+ * twice is kept twice, so a group can set a cvar or run a command more than
+ * once.
+ */
+static IdSpan AddPairs(ModeGroupTable &table, const std::vector<StringIdPair> &pairs, std::vector<StringId> &ids)
+{
+	ids.clear();
+	for (size_t i = 0; i < pairs.size(); i++)
+	{
+		ids.push_back(pairs[i].first);
+		ids.push_back(pairs[i].second);
+	}
+
+	return table.AddIds(ids.data(), ids.size());
+}
+
+class ModeGroupConfigParser : public ITextListener_SMC, public ConfigReaderListener
 {
 public:
-	ModeGroupConfigParser(std::map<std::string, ModeGroup> &groups) 
-		: m_Groups(groups), m_InModeGroups(false), m_InCvars(false), m_InCommands(false), m_InLoadPlugins(false), m_InUnloadPlugins(false)
+	ModeGroupConfigParser(ModeGroupTable &groups, ModeGroupSettings &settings) 
+		: m_Groups(groups), m_Settings(settings), m_GroupSection(false), m_HasSettings(false), m_InSettings(false), m_InModeGroups(false), m_InCvars(false), m_InCommands(false), m_InLoadPlugins(false), m_InUnloadPlugins(false)
+	{
+	}
+
+	/**
+	 * The stream is a single group section cut out of "ModeGroups".
+	 */
+	void SetGroupSection()
+	{
+		m_GroupSection = true;
+	}
+
+	/**
+	 * Whether the text had a "Settings" section.
+	 */
+	bool HasSettings() const
 	{
+		return m_HasSettings;
 	}
 
 	void ReadSMC_ParseStart()
 	{
-		m_CurrentGroup.name.clear();
-		m_CurrentGroup.plugin_directory.clear();
-		m_CurrentGroup.plugin_files.clear();
-		m_CurrentGroup.load_plugins.clear();
-		m_CurrentGroup.unload_plugins.clear();
-		m_CurrentGroup.use_sm_cvar = true;
-		m_CurrentGroup.cvars.clear();
-		m_CurrentGroup.commands.clear();
-		m_InModeGroups = false;
+		ResetCurrentGroup();
+		m_InSettings = false;
+		m_InModeGroups = m_GroupSection;
 		m_InCvars = false;
 		m_InCommands = false;
 		m_InLoadPlugins = false;
@@ -36,81 +113,119 @@ public:
 
 	SMCResult ReadSMC_NewSection(const SMCStates *states, const char *name)
 	{
-		if (strcmp(name, "ModeGroups") == 0)
+		OnSection(MakeString(name));
+		return SMCResult_Continue;
+	}
+
+	SMCResult ReadSMC_KeyValue(const SMCStates *states, const char *key, const char *value)
+	{
+		OnKeyValue(MakeString(key), MakeString(value));
+		return SMCResult_Continue;
+	}
+
+	SMCResult ReadSMC_LeavingSection(const SMCStates *states)
+	{
+		OnLeavingSection();
+		return SMCResult_Continue;
+	}
+
+	void ReadSMC_ParseEnd(bool halted, bool failed)
+	{
+	}
+
+	void OnSection(const ConfigString &name)
+	{
+		if (!m_InModeGroups && IsName(name, "Settings"))
+		{
+			m_InSettings = true;
+			m_HasSettings = true;
+			return;
+		}
+
+		if (IsName(name, "ModeGroups"))
 		{
 			m_InModeGroups = true;
-			return SMCResult_Continue;
+			return;
 		}
 
-		if (m_InModeGroups && !m_CurrentGroup.name.empty() && strcmp(name, "cvars") == 0)
+		if (m_InModeGroups && m_CurrentGroup.name != 0 && IsName(name, "cvars"))
 		{
 			m_InCvars = true;
-			return SMCResult_Continue;
+			return;
 		}
 
-		if (m_InModeGroups && !m_CurrentGroup.name.empty() && strcmp(name, "commands") == 0)
+		if (m_InModeGroups && m_CurrentGroup.name != 0 && IsName(name, "commands"))
 		{
 			m_InCommands = true;
-			return SMCResult_Continue;
+			return;
 		}
 
-		if (m_InModeGroups && !m_CurrentGroup.name.empty() && strcmp(name, "load_plugins") == 0)
+		if (m_InModeGroups && m_CurrentGroup.name != 0 && IsName(name, "load_plugins"))
 		{
 			m_InLoadPlugins = true;
-			return SMCResult_Continue;
+			return;
 		}
 
-		if (m_InModeGroups && !m_CurrentGroup.name.empty() && strcmp(name, "unload_plugins") == 0)
+		if (m_InModeGroups && m_CurrentGroup.name != 0 && IsName(name, "unload_plugins"))
 		{
 			m_InUnloadPlugins = true;
-			return SMCResult_Continue;
+			return;
 		}
 
 		if (m_InModeGroups)
 		{
-			m_CurrentGroup.name = name;
-			return SMCResult_Continue;
+			m_CurrentGroup.name = Intern(name);
 		}
-
-		return SMCResult_Continue;
 	}
 
-	SMCResult ReadSMC_KeyValue(const SMCStates *states, const char *key, const char *value)
+	void OnKeyValue(const ConfigString &key, const ConfigString &value)
 	{
-		if (m_CurrentGroup.name.empty())
-			return SMCResult_Continue;
+		if (m_InSettings)
+		{
+			ReadSettingsKeyValue(key, value);
+			return;
+		}
+
+		if (m_CurrentGroup.name == 0)
+			return;
 
 		if (m_InCvars)
 		{
-			m_CurrentGroup.cvars[key] = value;
+			m_Cvars.push_back(StringIdPair(Intern(key), Intern(value)));
 		}
 		else if (m_InCommands)
 		{
-			m_CurrentGroup.commands[key] = value;
+			m_Commands.push_back(StringIdPair(Intern(key), Intern(value)));
 		}
 		else if (m_InLoadPlugins)
 		{
-			m_CurrentGroup.load_plugins.push_back(value);
+			m_LoadPlugins.push_back(Intern(value));
 		}
 		else if (m_InUnloadPlugins)
 		{
-			m_CurrentGroup.unload_plugins.push_back(value);
+			m_UnloadPlugins.push_back(Intern(value));
 		}
-		else if (strcmp(key, "plugin_directory") == 0)
+		else if (IsName(key, "plugin_directory"))
 		{
-			m_CurrentGroup.plugin_directory = value;
+			m_CurrentGroup.plugin_directory = Intern(value);
 		}
-		else if (strcmp(key, "use_sm_cvar") == 0)
+		else if (IsName(key, "use_sm_cvar"))
 		{
-			m_CurrentGroup.use_sm_cvar = (strcmp(value, "1") == 0 || strcmp(value, "true") == 0);
+			m_CurrentGroup.use_sm_cvar = IsTrue(value);
+		}
+		else if (IsName(key, "suspend_on_leave"))
+		{
+			m_CurrentGroup.suspend_on_leave = IsTrue(value);
 		}
-
-		return SMCResult_Continue;
 	}
 
-	SMCResult ReadSMC_LeavingSection(const SMCStates *states)
+	void OnLeavingSection()
 	{
-		if (m_InCvars)
+		if (m_InSettings)
+		{
+			m_InSettings = false;
+		}
+		else if (m_InCvars)
 		{
 			m_InCvars = false;
 		}
@@ -126,33 +241,105 @@ public:
 		{
 			m_InUnloadPlugins = false;
 		}
-		else if (!m_CurrentGroup.name.empty())
+		else if (m_CurrentGroup.name != 0)
 		{
-			m_Groups[m_CurrentGroup.name] = m_CurrentGroup;
-			m_CurrentGroup.name.clear();
-			m_CurrentGroup.plugin_directory.clear();
-			m_CurrentGroup.plugin_files.clear();
-			m_CurrentGroup.load_plugins.clear();
-			m_CurrentGroup.unload_plugins.clear();
-			m_CurrentGroup.use_sm_cvar = true; // 重置为默认值
-			m_CurrentGroup.cvars.clear();
-			m_CurrentGroup.commands.clear();
+			m_CurrentGroup.load_plugins = m_Groups.AddIds(m_LoadPlugins.data(), m_LoadPlugins.size());
+			m_CurrentGroup.unload_plugins = m_Groups.AddIds(m_UnloadPlugins.data(), m_UnloadPlugins.size());
+			m_CurrentGroup.cvars = AddPairs(m_Groups, m_Cvars, m_PairIds);
+			m_CurrentGroup.commands = AddPairs(m_Groups, m_Commands, m_PairIds);
+			m_Groups.Add(m_CurrentGroup);
+			ResetCurrentGroup();
 		}
 		else if (m_InModeGroups)
 		{
 			m_InModeGroups = false;
 		}
+	}
 
-		return SMCResult_Continue;
+private:
+	static ConfigString MakeString(const char *str)
+	{
+		ConfigString string;
+		string.str = str;
+		string.length = strlen(str);
+		return string;
 	}
 
-	void ReadSMC_ParseEnd(bool halted, bool failed)
+	static bool IsName(const ConfigString &string, const char *name)
+	{
+		return string.length == strlen(name) && memcmp(string.str, name, string.length) == 0;
+	}
+
+	static bool IsTrue(const ConfigString &value)
+	{
+		return IsName(value, "1") || IsName(value, "true");
+	}
+
+	StringId Intern(const ConfigString &string)
+	{
+		return m_Groups.Intern(string.str, string.length);
+	}
+
+	void ResetCurrentGroup()
+	{
+		m_CurrentGroup = ModeGroup();
+		m_LoadPlugins.clear();
+		m_UnloadPlugins.clear();
+		m_Cvars.clear();
+		m_Commands.clear();
+	}
+
+	void ReadSettingsKeyValue(const ConfigString &key, const ConfigString &value)
 	{
+		// 数字要以 NUL 结尾才能转换, 设置只有几项, 复制一份
+		std::string number(value.str, value.length);
+
+		if (IsName(key, "switch_mode"))
+		{
+			m_Settings.incremental_switch = IsName(value, "incremental");
+		}
+		else if (IsName(key, "frame_budget_ms"))
+		{
+			m_Settings.frame_budget_ms = (float)atof(number.c_str());
+		}
+		else if (IsName(key, "prepare_timeout"))
+		{
+			m_Settings.prepare_timeout = (float)atof(number.c_str());
+		}
+		else if (IsName(key, "prepare_mlock"))
+		{
+			m_Settings.prepare_mlock = IsTrue(value);
+		}
+		else if (IsName(key, "prepare_memory_cap_mb"))
+		{
+			m_Settings.prepare_memory_cap = (size_t)atoi(number.c_str()) * 1024 * 1024;
+		}
+		else if (IsName(key, "lazy_parse"))
+		{
+			m_Settings.lazy_parse = IsTrue(value);
+		}
+		else if (IsName(key, "switch_debounce_ms"))
+		{
+			m_Settings.switch_debounce_ms = (float)atof(number.c_str());
+		}
+		else if (IsName(key, "suspend_memory_cap_mb"))
+		{
+			m_Settings.suspend_memory_cap = (size_t)atoi(number.c_str()) * 1024 * 1024;
+		}
 	}
 
 private:
-	std::map<std::string, ModeGroup> &m_Groups;
+	ModeGroupTable &m_Groups;
+	ModeGroupSettings &m_Settings;
+	bool m_GroupSection;
+	bool m_HasSettings;
 	ModeGroup m_CurrentGroup;
+	std::vector<StringId> m_LoadPlugins; // lists of m_CurrentGroup until it is added
+	std::vector<StringId> m_UnloadPlugins;
+	std::vector<StringIdPair> m_Cvars;
+	std::vector<StringIdPair> m_Commands;
+	std::vector<StringId> m_PairIds;
+	bool m_InSettings;
 	bool m_InModeGroups;
 	bool m_InCvars;
 	bool m_InCommands;
@@ -162,14 +349,47 @@ private:
 
 bool ModeGroupExtension::SDK_OnLoad(char *error, size_t maxlen, bool late)
 {
+	m_CurrentModeGroupId = INVALID_GROUP_ID;
+	m_ReloadQueued = false;
+	m_QueuedSwitch = SwitchRequest();
+	m_NextRequestId = 1;
+	m_RequestResults.clear();
+	m_RequestNotices.clear();
+	m_Suspended.clear();
+	m_SuspendOrder.clear();
+	m_SuspendedBytes = 0;
+	m_SuspendStamp = 0;
+
+	// 第一次加载等加载线程做完, 配置有错时扩展加载失败
 	if (!LoadConfig(error, maxlen))
 	{
 		return false;
 	}
 
+	// 已经加载的插件只在这里遍历一次, 之后由监听器维护索引
+	IPluginIterator *iter = plsys->GetPluginIterator();
+	while (iter->MorePlugins())
+	{
+		IPlugin *p = iter->GetPlugin();
+		m_PluginsByFile[p->GetFilename()] = p;
+		iter->NextPlugin();
+	}
+	iter->Release();
+
+	char statsPath[PLATFORM_MAX_PATH];
+	g_pSM->BuildPath(Path_SM, statsPath, sizeof(statsPath), "data/modegroup.stats");
+	m_Histograms.Load(statsPath);
+	g_pSM->BuildPath(Path_SM, statsPath, sizeof(statsPath), "data/modegroup.profile");
+	m_Profiler.Load(statsPath);
+
+	plsys->AddPluginsListener(this);
+	smutils->AddGameFrameHook(&::OnGameFrame);
+
 	sharesys->AddNatives(myself, g_Natives);
 
 	m_pModeGroupChangedForward = forwards->CreateForward("OnModeGroupChanged", ET_Ignore, 2, NULL, Param_String, Param_String);
+	m_pRequestDoneForward = forwards->CreateForward("OnModeGroupRequestDone", ET_Ignore, 3, NULL,
+		Param_Cell, Param_Cell, Param_String);
 
 	rootconsole->AddRootConsoleCommand3("modegroup", "Manage Mode Groups", this);
 
@@ -180,13 +400,33 @@ bool ModeGroupExtension::SDK_OnLoad(char *error, size_t maxlen, bool late)
 
 void ModeGroupExtension::SDK_OnUnload()
 {
+	if (m_Load)
+	{
+		m_LoadThread.join();
+		m_Load.reset();
+	}
+	m_ReloadQueued = false;
+	m_QueuedSwitch = SwitchRequest();
+	m_RequestNotices.clear();
+
 	UnloadCurrentModeGroup();
+	ReleasePreparedGroup();
+	SaveStats();
+
+	smutils->RemoveGameFrameHook(&::OnGameFrame);
+	plsys->RemovePluginsListener(this);
+	m_PluginsByFile.clear();
 
 	if (m_pModeGroupChangedForward)
 	{
 		forwards->ReleaseForward(m_pModeGroupChangedForward);
 		m_pModeGroupChangedForward = NULL;
 	}
+	if (m_pRequestDoneForward)
+	{
+		forwards->ReleaseForward(m_pRequestDoneForward);
+		m_pRequestDoneForward = NULL;
+	}
 
 	rootconsole->RemoveRootConsoleCommand("modegroup", this);
 
@@ -202,271 +442,2095 @@ bool ModeGroupExtension::QueryRunning(char *error, size_t maxlen)
 	return true;
 }
 
-bool ModeGroupExtension::LoadConfig(char *error, size_t maxlen)
+void ModeGroupExtension::OnCoreMapEnd()
 {
-	char path[PLATFORM_MAX_PATH];
-	g_pSM->BuildPath(Path_SM, path, sizeof(path), "configs/modegroup.cfg");
+	// 换图的加载画面里完成切换, 玩家感觉不到卡顿
+	if (!m_PendingModeGroup.empty())
+	{
+		std::string groupName;
+		groupName.swap(m_PendingModeGroup);
 
-	ModeGroupConfigParser parser(m_ModeGroups);
-	SMCStates states;
-	char smcError[256];
+		// 排队中的请求目标相同就并入这次切换, 否则下一帧会把刚做完的切换再换掉, 直接报告为被替换
+		SwitchRequest merged;
+		if (m_QueuedSwitch.id != 0)
+		{
+			const ModeGroup *pQueued = m_ModeGroups->Find(m_QueuedSwitch.group.c_str());
+			if (pQueued && pQueued == m_ModeGroups->Find(groupName.c_str()))
+			{
+				merged = m_QueuedSwitch;
+			}
+			else
+			{
+				g_pSM->LogMessage(myself, "Switch request #%d to %s superseded by the deferred switch to %s",
+					m_QueuedSwitch.id, m_QueuedSwitch.group.c_str(), groupName.c_str());
+				EndSwitchRequest(m_QueuedSwitch.id, SwitchRequest_Superseded, m_QueuedSwitch.group);
+			}
+			m_QueuedSwitch = SwitchRequest();
+		}
 
-	SMCError err = textparsers->ParseSMCFile(path, &parser, &states, smcError, sizeof(smcError));
-	if (err != SMCError_Okay)
+		g_pSM->LogMessage(myself, "Running deferred switch to mode group: %s", groupName.c_str());
+		if (!SwitchModeGroup(groupName.c_str(), true, merged.id, merged.id != 0 ? &merged.requested : NULL)
+			&& merged.id != 0)
+		{
+			EndSwitchRequest(merged.id, SwitchRequest_Failed, groupName);
+		}
+	}
+	else if (m_Switch.phase != SwitchPhase_None)
 	{
-		ke::SafeSprintf(error, maxlen, "Failed to parse modegroup.cfg: %s (line %u, col %u)", 
-			smcError, states.line, states.col);
-		return false;
+		RunSwitch(0.0f);
 	}
 
-	g_pSM->LogMessage(myself, "Loaded %zu mode groups", m_ModeGroups.size());
-
-	return true;
+	SaveStats();
 }
 
-bool ModeGroupExtension::SwitchModeGroup(const char *groupName)
+void ModeGroupExtension::SaveStats()
 {
-	std::string oldGroup = m_CurrentModeGroup;
-
-	UnloadCurrentModeGroup();
-
-	std::map<std::string, ModeGroup>::iterator it = m_ModeGroups.find(groupName);
-	if (it == m_ModeGroups.end())
+	char path[PLATFORM_MAX_PATH];
+	g_pSM->BuildPath(Path_SM, path, sizeof(path), "data/modegroup.stats");
+	if (!m_Histograms.Save(path))
 	{
-		g_pSM->LogError(myself, "Mode group '%s' not found", groupName);
-		return false;
+		g_pSM->LogError(myself, "Could not write %s", path);
 	}
 
-	LoadModeGroup(it->second);
-
-	m_CurrentModeGroup = groupName;
-
-	if (m_pModeGroupChangedForward)
+	g_pSM->BuildPath(Path_SM, path, sizeof(path), "data/modegroup.profile");
+	if (!m_Profiler.Save(path))
 	{
-		m_pModeGroupChangedForward->PushString(oldGroup.c_str());
-		m_pModeGroupChangedForward->PushString(groupName);
-		m_pModeGroupChangedForward->Execute(NULL);
+		g_pSM->LogError(myself, "Could not write %s", path);
 	}
-
-	g_pSM->LogMessage(myself, "Switched to mode group: %s", groupName);
-
-	return true;
 }
 
-void ModeGroupExtension::UnloadCurrentModeGroup()
+/**
+ * Parses config text with ConfigReader, which reports errors the same way as
+ * the SMC parser. Nothing here calls into SourceMod, so the loader and worker
+ * threads can use it; the main thread turns the error code into text with
+ * FormatParseError().
+ */
+static SMCError ParseConfigText(const char *data, size_t length, ModeGroupConfigParser &parser, SMCStates *states)
 {
-	if (m_CurrentModeGroup.empty())
-		return;
-
-	for (size_t i = 0; i < m_LoadedPlugins.size(); i++)
-	{
-		UnloadPlugin(m_LoadedPlugins[i].c_str());
-	}
+	ConfigReader reader;
+	parser.ReadSMC_ParseStart();
+	SMCError err = reader.Parse(data, length, &parser, states);
+	parser.ReadSMC_ParseEnd(false, err != SMCError_Okay);
+	return err;
+}
 
-	m_LoadedPlugins.clear();
-	m_CurrentModeGroup.clear();
+static void FormatParseError(char *error, size_t maxlen, const char *file, SMCError err, const SMCStates &states)
+{
+	const char *str = textparsers->GetSMCErrorString(err);
+	ke::SafeSprintf(error, maxlen, "Failed to parse %s: %s (line %u, col %u)", file,
+		str ? str : "Unknown error", states.line, states.col);
 }
 
-void ModeGroupExtension::LoadModeGroup(const ModeGroup &group)
+/**
+ * Adds every group of the index without parsing its body. The table keeps a
+ * copy of the config text, the file may change on disk in the meantime.
+ * file names the config in errors found when a group is parsed later.
+ */
+static SMCError IndexModeGroups(const char *file, const char *data, size_t length,
+	const std::vector<ConfigSection> &sections, ModeGroupTable &groups, SMCStates *states)
 {
-	if (!group.plugin_directory.empty())
-	{
-		std::vector<std::string> plugins;
-		ScanDirectoryForPlugins(group.plugin_directory.c_str(), plugins);
+	StringId fileName = groups.Intern(file);
 
-		for (size_t i = 0; i < plugins.size(); i++)
+	for (size_t i = 0; i < sections.size(); i++)
+	{
+		const ConfigSection &section = sections[i];
+		if (section.escaped)
 		{
-			if (LoadPlugin(plugins[i].c_str()))
+			// 名字里的转义交给解析器处理, 这个分组直接完整解析
+			ModeGroupSettings unused;
+			ModeGroupConfigParser parser(groups, unused);
+			parser.SetGroupSection();
+
+			SMCError err = ParseConfigText(data + section.offset, section.length, parser, states);
+			if (err != SMCError_Okay)
 			{
-				m_LoadedPlugins.push_back(plugins[i]);
+				// 范围的第一行接在原文件那一行的中间, 列号也要加上偏移
+				if (states->line == 1)
+				{
+					states->col += section.col - 1;
+				}
+				states->line += section.line - 1;
+				return err;
 			}
+			continue;
 		}
-	}
 
-	// 加载手动指定的插件
-	for (size_t i = 0; i < group.load_plugins.size(); i++)
-	{
-		if (LoadPlugin(group.load_plugins[i].c_str()))
-		{
-			m_LoadedPlugins.push_back(group.load_plugins[i]);
-		}
+		ModeGroup group;
+		group.name = groups.Intern(section.name.c_str(), section.name.size());
+		group.parsed = false;
+		group.source_offset = section.offset;
+		group.source_length = section.length;
+		group.source_line = section.line;
+		group.source_col = section.col;
+		group.source_file = fileName;
+		groups.Add(group);
 	}
 
-	// 卸载手动指定的插件
-	for (size_t i = 0; i < group.unload_plugins.size(); i++)
-	{
-		UnloadPlugin(group.unload_plugins[i].c_str());
-	}
+	std::string source(data, length);
+	groups.SetSource(source);
+	return SMCError_Okay;
+}
 
-	for (std::map<std::string, std::string>::const_iterator it = group.cvars.begin();
-		it != group.cvars.end(); ++it)
+/**
+ * Parses a file of configs/modegroups on a worker thread with ConfigIndex and
+ * ConfigReader.
+ */
+static void ParseConfigFile(ConfigFile &file, const char *data, size_t length, bool lazy)
+{
+	std::vector<ConfigSection> settingSections, groupSections;
+	if (lazy && ConfigIndex::Scan(data, length, settingSections, groupSections))
 	{
-		char cmd[256];
-		if (group.use_sm_cvar)
-		{
-			ke::SafeSprintf(cmd, sizeof(cmd), "sm_cvar %s %s\n", it->first.c_str(), it->second.c_str());
-		}
-		else
-		{
-			ke::SafeSprintf(cmd, sizeof(cmd), "%s %s\n", it->first.c_str(), it->second.c_str());
-		}
-		gamehelpers->ServerCommand(cmd);
-		g_pSM->LogMessage(myself, "Set Cvar %s to %s", it->first.c_str(), it->second.c_str());
+		file.has_settings = !settingSections.empty();
+		std::string name = "modegroups/" + file.name;
+		file.error = IndexModeGroups(name.c_str(), data, length, groupSections, *file.groups, &file.states);
+		return;
 	}
 
-	for (std::map<std::string, std::string>::const_iterator it = group.commands.begin();
-		it != group.commands.end(); ++it)
-	{
-		if (strcmp(it->first.c_str(), "command") == 0)
-		{
-			char cmd[256];
-			ke::SafeSprintf(cmd, sizeof(cmd), "%s\n", it->second.c_str());
-			gamehelpers->ServerCommand(cmd);
-			g_pSM->LogMessage(myself, "Executed Command: %s", it->second.c_str());
-		}
-		else
-		{
-			char cmd[256];
-			ke::SafeSprintf(cmd, sizeof(cmd), "%s %s\n", it->first.c_str(), it->second.c_str());
-			gamehelpers->ServerCommand(cmd);
-			g_pSM->LogMessage(myself, "Executed Command: %s", cmd);
-		}
-	}
+	// 目录里的文件不能修改设置, 解析出来的设置直接丢掉
+	ModeGroupSettings unused;
+	ModeGroupConfigParser parser(*file.groups, unused);
+	file.error = ParseConfigText(data, length, parser, &file.states);
+	file.has_settings = parser.HasSettings();
 }
 
-void ModeGroupExtension::ScanDirectoryForPlugins(const char *path, std::vector<std::string> &plugins)
+/**
+ * Parses modegroup.cfg without calling into SourceMod, so it can run on the
+ * loader thread.
+ */
+static SMCError ParseMainConfig(const char *path, ModeGroupTable &groups, ModeGroupSettings &settings,
+	SMCStates *states)
 {
-	char fullPath[PLATFORM_MAX_PATH];
-	g_pSM->BuildPath(Path_SM, fullPath, sizeof(fullPath), "plugins/%s", path);
+	settings = ModeGroupSettings();
+
+	ModeGroupConfigParser parser(groups, settings);
+	SMCError err;
+	bool lazy = false;
 
-	IDirectory *dir = libsys->OpenDirectory(fullPath);
-	if (!dir)
+	// cfg 随时可能被编辑, 读进内存再解析, 不做映射
+	std::string data;
+	bool read = ReadConfigFile(path, data);
+	if (!read || data.empty())
 	{
-		g_pSM->LogError(myself, "Could not open directory: %s", fullPath);
-		return;
+		// 空文件没有分组, 打不开时报告和 SMC 解析器一样的错误
+		err = read ? SMCError_Okay : SMCError_StreamOpen;
+		states->line = 0;
+		states->col = 0;
 	}
-
-	while (dir->MoreFiles())
+	else
 	{
-		const char *name = dir->GetEntryName();
-		bool isDir = dir->IsEntryDirectory();
-
-		if (isDir && strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+		// 先扫一遍找出 Settings 和各个分组的位置, 打开 lazy_parse 时只解析 Settings
+		std::vector<ConfigSection> settingSections, groupSections;
+		if (ConfigIndex::Scan(data.data(), data.size(), settingSections, groupSections))
 		{
-			char subPath[PLATFORM_MAX_PATH];
-			ke::SafeSprintf(subPath, sizeof(subPath), "%s/%s", path, name);
-			ScanDirectoryForPlugins(subPath, plugins);
-		}
-		else if (!isDir)
-		{
-			size_t len = strlen(name);
-			if (len > 4 && strcasecmp(name + len - 4, ".smx") == 0)
+			err = SMCError_Okay;
+			for (size_t i = 0; i < settingSections.size() && err == SMCError_Okay; i++)
 			{
-				char pluginPath[PLATFORM_MAX_PATH];
-				ke::SafeSprintf(pluginPath, sizeof(pluginPath), "%s/%s", path, name);
-				plugins.push_back(pluginPath);
+				err = ParseConfigText(data.data() + settingSections[i].offset, settingSections[i].length,
+					parser, states);
 			}
+
+			lazy = (err == SMCError_Okay && settings.lazy_parse);
 		}
 
-		dir->NextEntry();
+		if (lazy)
+		{
+			err = IndexModeGroups("modegroup.cfg", data.data(), data.size(), groupSections, groups, states);
+		}
+		else
+		{
+			// 出错时由完整解析报告准确的位置
+			settings = ModeGroupSettings();
+			err = ParseConfigText(data.data(), data.size(), parser, states);
+		}
 	}
 
-	libsys->CloseDirectory(dir);
+	return err;
 }
 
-bool ModeGroupExtension::LoadPlugin(const char *path)
+bool ModeGroupExtension::ParseConfig(const char *path, ModeGroupTable &groups,
+	ModeGroupSettings &settings, char *error, size_t maxlen)
 {
-	char fullPath[PLATFORM_MAX_PATH];
-	g_pSM->BuildPath(Path_SM, fullPath, sizeof(fullPath), "plugins/%s", path);
-
-	char error[256];
-	bool wasloaded;
-	IPlugin *pPlugin = plsys->LoadPlugin(path, false, PluginType_MapUpdated, error, sizeof(error), &wasloaded);
-	if (!pPlugin)
+	SMCStates states;
+	SMCError err = ParseMainConfig(path, groups, settings, &states);
+	if (err != SMCError_Okay)
 	{
-		g_pSM->LogError(myself, "Failed to load plugin %s: %s", path, error);
+		FormatParseError(error, maxlen, "modegroup.cfg", err, states);
 		return false;
 	}
 
-	g_pSM->LogMessage(myself, "Loaded plugin: %s", path);
 	return true;
 }
 
-void ModeGroupExtension::UnloadPlugin(const char *path)
+static std::string GetConfigFileName(const ConfigDirectory &files, size_t origin)
 {
-	char fullPath[PLATFORM_MAX_PATH];
-	g_pSM->BuildPath(Path_SM, fullPath, sizeof(fullPath), "plugins/%s", path);
-
-	IPlugin *pPlugin = NULL;
-	IPluginIterator *iter = plsys->GetPluginIterator();
-	while (iter->MorePlugins())
+	if (origin == 0)
 	{
-		IPlugin *p = iter->GetPlugin();
-		if (strcmp(p->GetFilename(), path) == 0)
-		{
-			pPlugin = p;
-			break;
-		}
-		iter->NextPlugin();
+		return "modegroup.cfg";
 	}
-	iter->Release();
+	return "modegroups/" + files.Get(origin - 1).name;
+}
 
-	if (!pPlugin)
-	{
-		return;
-	}
+static void AddConfigMessage(ConfigLoad &load, bool error, const char *format, ...)
+{
+	char buffer[512];
+	va_list ap;
+	va_start(ap, format);
+	ke::SafeVsprintf(buffer, sizeof(buffer), format, ap);
+	va_end(ap);
+
+	ConfigMessage message;
+	message.error = error;
+	message.text = buffer;
+	load.messages.push_back(message);
+}
 
-	if (pPlugin->GetStatus() != Plugin_Running)
+bool ModeGroupExtension::LoadConfig(char *error, size_t maxlen)
+{
+	StartConfigLoad(false);
+	return PublishConfig(error, maxlen);
+}
+
+void ModeGroupExtension::StartConfigLoad(bool reload)
+{
+	if (m_Load)
 	{
+		m_ReloadQueued = true;
+		g_pSM->LogMessage(myself, "A configuration load is already running, reloading again once it is live");
 		return;
 	}
 
-	if (!plsys->UnloadPlugin(pPlugin))
+	// reload 时插件目录也全部重新列出, 已编译的计划因为目录版本变了会在下次用到时重新编译
+	if (reload)
 	{
-		g_pSM->LogError(myself, "Failed to unload plugin %s", path);
-		return;
+		m_PluginDirs.Clear();
 	}
 
-	g_pSM->LogMessage(myself, "Unloaded plugin: %s", path);
-}
+	ConfigLoad *load = new ConfigLoad();
+	load->reload = reload;
+	load->groups = std::make_shared<ModeGroupTable>();
 
-void ModeGroupExtension::ReloadConfig()
-{
-	UnloadCurrentModeGroup();
-	m_ModeGroups.clear();
+	char path[PLATFORM_MAX_PATH];
+	g_pSM->BuildPath(Path_SM, path, sizeof(path), "configs/modegroup.cfg");
+	load->path = path;
+	g_pSM->BuildPath(Path_SM, path, sizeof(path), "data/modegroup.cache");
+	load->cache_path = path;
 
-	char error[256];
-	if (LoadConfig(error, sizeof(error)))
+	if (reload)
 	{
-		g_pSM->LogMessage(myself, "Configuration reloaded successfully");
+		load->old_hash = m_ConfigHash;
+		load->old_lazy = m_Settings.lazy_parse;
+		load->old_groups = m_ModeGroups;
 	}
 	else
 	{
-		g_pSM->LogError(myself, "Failed to reload configuration: %s", error);
+		m_ModeGroups = std::make_shared<ModeGroupTable>();
+		m_GroupStates.clear();
+		m_Settings = ModeGroupSettings();
+		m_ConfigHash = 0;
+		m_ConfigFiles.Clear();
 	}
+
+	// 列目录要用 libsys, 在主线程做, 解析和合并都在加载线程
+	g_pSM->BuildPath(Path_SM, path, sizeof(path), "configs/modegroups");
+	load->files_listed = m_ConfigFiles.List(path);
+
+	m_Load.reset(load);
+	m_LoadThread = std::thread(&ModeGroupExtension::RunConfigLoad, this, load);
 }
 
-void ModeGroupExtension::ListModeGroups()
+void ModeGroupExtension::RunConfigLoad(ConfigLoad *load)
 {
-	rootconsole->ConsolePrint("Available mode groups:");
-	for (std::map<std::string, ModeGroup>::iterator it = m_ModeGroups.begin();
-		it != m_ModeGroups.end(); ++it)
+	// 加载线程只碰 load 和 m_ConfigFiles, 不调用 SourceMod 的接口, 错误文字也由主线程去查
+	StopWatch watch;
+
+	load->hashed = HashFile(load->path.c_str(), &load->hash);
+
+	bool filesParsed = false;
+	if (load->reload && load->hashed && load->hash == load->old_hash)
 	{
-		rootconsole->ConsolePrint("  - %s", it->first.c_str());
+		// modegroup.cfg 没变, 只需要看 modegroups 目录里有没有文件变化
+		filesParsed = true;
+		if (!m_ConfigFiles.Parse(ParseConfigFile, load->old_lazy) && !load->files_listed)
+		{
+			load->unchanged = true;
+			load->ms = watch.ElapsedMs();
+			load->done.store(true, std::memory_order_release);
+			return;
+		}
 	}
-}
 
-void ModeGroupExtension::CurrentModeGroup()
-{
-	if (m_CurrentModeGroup.empty())
+	if (ReadConfig(*load))
 	{
-		rootconsole->ConsolePrint("No mode group currently active");
+		load->main_groups = load->groups->Count();
+		if (!filesParsed || load->settings.lazy_parse != load->old_lazy)
+		{
+			m_ConfigFiles.Parse(ParseConfigFile, load->settings.lazy_parse);
+		}
+		load->failed = !MergeConfigFiles(*load);
 	}
 	else
 	{
-		rootconsole->ConsolePrint("Current mode group: %s", m_CurrentModeGroup.c_str());
+		load->failed = true;
 	}
-}
+
+	if (!load->failed)
+	{
+		// ID 和新旧分组的比较也在这里做, 主线程发布时只换指针
+		m_GroupIds.Assign(*load->groups);
+		DiffConfig(*load);
+	}
+
+	load->ms = watch.ElapsedMs();
+	load->done.store(true, std::memory_order_release);
+}
+
+bool ModeGroupExtension::ReadConfig(ConfigLoad &load)
+{
+	load.cached = load.hashed && ConfigCache::Read(load.cache_path.c_str(), load.hash, *load.groups, load.settings);
+	if (load.cached)
+	{
+		return true;
+	}
+
+	load.error = ParseMainConfig(load.path.c_str(), *load.groups, load.settings, &load.error_states);
+	if (load.error != SMCError_Okay)
+	{
+		load.error_file = "modegroup.cfg";
+		return false;
+	}
+
+	// 缓存只保存 modegroup.cfg 本身, modegroups 目录下的文件每次单独合并
+	// 延迟解析的表里大部分分组还没有内容, 不写缓存
+	if (load.hashed && !load.settings.lazy_parse
+		&& !ConfigCache::Write(load.cache_path.c_str(), load.hash, *load.groups, load.settings))
+	{
+		AddConfigMessage(load, true, "Could not write %s", load.cache_path.c_str());
+	}
+
+	return true;
+}
+
+bool ModeGroupExtension::MergeConfigFiles(ConfigLoad &load)
+{
+	ModeGroupTable &groups = *load.groups;
+
+	// 每个分组来自哪个文件, 0 是 modegroup.cfg, 其余是目录里的下标 + 1
+	std::vector<size_t> origins(groups.Count(), 0);
+
+	for (size_t i = 0; i < m_ConfigFiles.Count(); i++)
+	{
+		const ConfigFile &file = m_ConfigFiles.Get(i);
+		if (file.error != SMCError_Okay)
+		{
+			load.error = file.error;
+			load.error_states = file.states;
+			load.error_file = "modegroups/" + file.name;
+			return false;
+		}
+
+		if (file.has_settings && file.parsed)
+		{
+			AddConfigMessage(load, true, "Settings in modegroups/%s are ignored, only modegroup.cfg can change them",
+				file.name.c_str());
+		}
+
+		const ModeGroupTable &fileGroups = *file.groups;
+		for (size_t j = 0; j < fileGroups.Count(); j++)
+		{
+			const ModeGroup &group = fileGroups.Get(j);
+			const char *name = fileGroups.GetString(group.name);
+
+			// 重名的分组以后合并的为准, 和同一个文件里一样
+			const ModeGroup *existing = groups.Find(name);
+			if (existing)
+			{
+				size_t index = groups.IndexOf(*existing);
+				AddConfigMessage(load, false, "Mode group %s in modegroups/%s replaces the one in %s",
+					name, file.name.c_str(), GetConfigFileName(m_ConfigFiles, origins[index]).c_str());
+				origins[index] = i + 1;
+			}
+			else
+			{
+				origins.push_back(i + 1);
+			}
+
+			groups.Import(fileGroups, group);
+		}
+	}
+
+	return true;
+}
+
+bool ModeGroupExtension::IsConfigLoadDone() const
+{
+	return !m_Load || m_Load->done.load(std::memory_order_acquire);
+}
+
+void ModeGroupExtension::WaitForConfigLoad()
+{
+	if (m_Load)
+	{
+		PublishConfig(NULL, 0);
+	}
+}
+
+bool ModeGroupExtension::PublishConfig(char *error, size_t maxlen)
+{
+	m_LoadThread.join();
+	std::unique_ptr<ConfigLoad> load(m_Load.release());
+
+	for (size_t i = 0; i < load->messages.size(); i++)
+	{
+		const ConfigMessage &message = load->messages[i];
+		if (message.error)
+		{
+			g_pSM->LogError(myself, "%s", message.text.c_str());
+		}
+		else
+		{
+			g_pSM->LogMessage(myself, "%s", message.text.c_str());
+		}
+	}
+
+	bool ok = !load->failed;
+	if (!ok)
+	{
+		// 下次加载重新解析全部文件, 不会因为文件没变而当成没有变化
+		m_ConfigFiles.Clear();
+
+		char message[256];
+		FormatParseError(message, sizeof(message), load->error_file.c_str(), load->error, load->error_states);
+
+		if (error)
+		{
+			ke::SafeStrcpy(error, maxlen, message);
+		}
+		else
+		{
+			g_pSM->LogError(myself, "Failed to %s configuration: %s", load->reload ? "reload" : "load", message);
+		}
+	}
+	else if (load->unchanged)
+	{
+		g_pSM->LogMessage(myself, "Configuration unchanged, nothing to reload");
+	}
+	else if (load->reload)
+	{
+		ApplyReloadedConfig(*load);
+	}
+	else
+	{
+		// 分组计划在第一次用到时才编译, 启动时不扫描插件目录
+		m_ModeGroups = load->groups;
+		m_GroupStates.assign(m_ModeGroups->Count(), ModeGroupState());
+		m_Settings = load->settings;
+		if (load->hashed)
+		{
+			m_ConfigHash = load->hash;
+		}
+
+		if (load->cached)
+		{
+			g_pSM->LogMessage(myself, "Loaded %zu mode groups (cached)", load->main_groups);
+		}
+		else if (m_Settings.lazy_parse)
+		{
+			g_pSM->LogMessage(myself, "Indexed %zu mode groups, each is parsed on first use", load->main_groups);
+		}
+		else
+		{
+			g_pSM->LogMessage(myself, "Loaded %zu mode groups", load->main_groups);
+		}
+
+		if (m_ConfigFiles.Count() != 0)
+		{
+			g_pSM->LogMessage(myself, "Added %zu files from configs/modegroups, %zu mode groups in total",
+				m_ConfigFiles.Count(), m_ModeGroups->Count());
+		}
+	}
+
+	// 旧表没有切换或预热的分组引用时, 在这里随 load 一起释放
+	load.reset();
+
+	if (m_ReloadQueued)
+	{
+		m_ReloadQueued = false;
+		StartConfigLoad(true);
+	}
+
+	return ok;
+}
+
+/**
+ * Parses the source text of a lazy group into its own table, without calling
+ * into SourceMod. The published table is not touched.
+ */
+static SMCError ParseGroupBody(const ModeGroupTable &table, const ModeGroup &group, ModeGroupTable &body,
+	SMCStates *states)
+{
+	ModeGroupSettings unused;
+	ModeGroupConfigParser parser(body, unused);
+	parser.SetGroupSection();
+
+	SMCError err = ParseConfigText(table.GetSource(group.source_offset), group.source_length, parser, states);
+	if (err == SMCError_Okay && body.Count() != 1)
+	{
+		err = SMCError_InvalidSection1;
+	}
+	return err;
+}
+
+bool ModeGroupExtension::ParseModeGroup(const ModeGroupTable &table, const ModeGroup &group, ModeGroupTable &body)
+{
+	SMCStates states;
+	SMCError err = ParseGroupBody(table, group, body, &states);
+	if (err != SMCError_Okay)
+	{
+		// 保存的范围从分组名开始, 第一行的列号要加上分组名在原文件那一行的位置
+		unsigned int col = states.col;
+		if (states.line == 1)
+		{
+			col += group.source_col - 1;
+		}
+
+		const char *str = textparsers->GetSMCErrorString(err);
+		g_pSM->LogError(myself, "Failed to parse mode group %s in %s: %s (line %u, col %u)",
+			table.GetString(group.name), table.GetString(group.source_file), str ? str : "Unknown error",
+			group.source_line + states.line - 1, col);
+		return false;
+	}
+
+	return true;
+}
+
+const ModeGroup *ModeGroupExtension::GetGroupBody(const ModeGroup &group, const ModeGroupTable *&table)
+{
+	table = m_ModeGroups.get();
+	if (group.parsed)
+	{
+		return &group;
+	}
+
+	// 延迟解析的分组第一次用到时解析到单独的小表, 出错时每次使用都重新报告
+	ModeGroupState &state = m_GroupStates[m_ModeGroups->IndexOf(group)];
+	if (!state.body)
+	{
+		std::shared_ptr<ModeGroupTable> body = std::make_shared<ModeGroupTable>();
+		if (!ParseModeGroup(*m_ModeGroups, group, *body))
+		{
+			return NULL;
+		}
+		state.body = body;
+	}
+
+	table = state.body.get();
+	return &state.body->Get(0);
+}
+
+bool ModeGroupExtension::HashFile(const char *path, uint64_t *hash)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+	{
+		return false;
+	}
+
+	uint64_t h = ConfigCache::Hash(NULL, 0);
+	unsigned char buffer[16384];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+	{
+		h = ConfigCache::Hash(buffer, read, h);
+	}
+
+	bool failed = ferror(fp) != 0;
+	fclose(fp);
+
+	if (failed)
+	{
+		return false;
+	}
+
+	*hash = h;
+	return true;
+}
+
+static bool IsSameString(const ModeGroupTable &tableA, StringId a, const ModeGroupTable &tableB, StringId b)
+{
+	return strcmp(tableA.GetString(a), tableB.GetString(b)) == 0;
+}
+
+static bool IsSameSpan(const ModeGroupTable &tableA, IdSpan a, const ModeGroupTable &tableB, IdSpan b)
+{
+	if (a.count != b.count)
+	{
+		return false;
+	}
+
+	const StringId *idsA = tableA.GetIds(a);
+	const StringId *idsB = tableB.GetIds(b);
+	for (uint32_t i = 0; i < a.count; i++)
+	{
+		if (!IsSameString(tableA, idsA[i], tableB, idsB[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool IsSameSource(const ModeGroupTable &tableA, const ModeGroup &a, const ModeGroupTable &tableB, const ModeGroup &b)
+{
+	return a.source_length != 0 && a.source_length == b.source_length
+		&& memcmp(tableA.GetSource(a.source_offset), tableB.GetSource(b.source_offset), a.source_length) == 0;
+}
+
+bool ModeGroupExtension::IsSameModeGroup(const ModeGroupTable &tableA, const ModeGroup &a,
+	const ModeGroupTable &tableB, const ModeGroup &b)
+{
+	// 两个表的字符串 ID 互不相干, 只能比较内容
+	return IsSameString(tableA, a.name, tableB, b.name)
+		&& IsSameString(tableA, a.plugin_directory, tableB, b.plugin_directory)
+		&& IsSameSpan(tableA, a.load_plugins, tableB, b.load_plugins)
+		&& IsSameSpan(tableA, a.unload_plugins, tableB, b.unload_plugins)
+		&& a.use_sm_cvar == b.use_sm_cvar
+		&& a.suspend_on_leave == b.suspend_on_leave
+		&& IsSameSpan(tableA, a.cvars, tableB, b.cvars)
+		&& IsSameSpan(tableA, a.commands, tableB, b.commands);
+}
+
+bool ModeGroupExtension::IsUnchangedModeGroup(const ModeGroupTable &oldTable, const ModeGroup &old,
+	const ModeGroupTable &groups, const ModeGroup &group)
+{
+	// 延迟解析的分组原文相同就没有变化, 不用解析
+	if (IsSameSource(oldTable, old, groups, group))
+	{
+		return true;
+	}
+
+	// 没解析过的一边解析到临时的表里再比较, 解析出错的算作有变化
+	ModeGroupTable oldBody, body;
+	SMCStates states;
+	const ModeGroupTable *pOldTable = &oldTable;
+	const ModeGroup *pOld = &old;
+	if (!old.parsed)
+	{
+		if (ParseGroupBody(oldTable, old, oldBody, &states) != SMCError_Okay)
+		{
+			return false;
+		}
+		pOldTable = &oldBody;
+		pOld = &oldBody.Get(0);
+	}
+
+	const ModeGroupTable *pTable = &groups;
+	const ModeGroup *pGroup = &group;
+	if (!group.parsed)
+	{
+		if (ParseGroupBody(groups, group, body, &states) != SMCError_Okay)
+		{
+			return false;
+		}
+		pTable = &body;
+		pGroup = &body.Get(0);
+	}
+
+	return IsSameModeGroup(*pOldTable, *pOld, *pTable, *pGroup);
+}
+
+bool ModeGroupExtension::SwitchModeGroup(const char *groupName, bool immediate, int request,
+	const StopWatch *requested)
+{
+	const ModeGroup *pGroup = m_ModeGroups->Find(groupName);
+	if (!pGroup)
+	{
+		g_pSM->LogError(myself, "Mode group '%s' not found", groupName);
+		return false;
+	}
+
+	const ModeGroupTable *table;
+	if (!GetGroupBody(*pGroup, table))
+	{
+		return false;
+	}
+
+	bool abandoned = false;
+	if (m_Switch.phase != SwitchPhase_None)
+	{
+		// 名字不区分大小写, 用配置里的写法比较
+		if (m_Switch.group == m_ModeGroups->GetString(pGroup->name))
+		{
+			// 正在做的切换改为完成新的请求
+			if (request != 0)
+			{
+				if (m_Switch.request != 0)
+				{
+					EndSwitchRequest(m_Switch.request, SwitchRequest_Superseded, m_Switch.group);
+				}
+				m_Switch.request = request;
+			}
+			return true;
+		}
+
+		// 放弃还没做完的切换, 已经加载/卸载的插件都记录在 m_LoadedPlugins 里
+		g_pSM->LogMessage(myself, "Abandoning switch to mode group: %s", m_Switch.group.c_str());
+		if (m_Switch.request != 0)
+		{
+			EndSwitchRequest(m_Switch.request, SwitchRequest_Superseded, m_Switch.group);
+		}
+		m_Switch = SwitchState();
+		abandoned = true;
+	}
+
+	StartSwitch(*pGroup, abandoned, immediate, request, requested);
+
+	return true;
+}
+
+int ModeGroupExtension::RequestSwitch(const char *groupName)
+{
+	const ModeGroup *pGroup = m_ModeGroups->Find(groupName);
+	if (!pGroup)
+	{
+		g_pSM->LogError(myself, "Mode group '%s' not found", groupName);
+		return 0;
+	}
+	groupName = m_ModeGroups->GetString(pGroup->name);
+
+	if (m_QueuedSwitch.id != 0)
+	{
+		// 同一个分组的请求合并, 调用方拿到同一个 ID, 也不重新计算防抖时间
+		if (m_QueuedSwitch.group == groupName)
+		{
+			return m_QueuedSwitch.id;
+		}
+
+		g_pSM->LogMessage(myself, "Switch request #%d to %s superseded by a request for %s",
+			m_QueuedSwitch.id, m_QueuedSwitch.group.c_str(), groupName);
+		EndSwitchRequest(m_QueuedSwitch.id, SwitchRequest_Superseded, m_QueuedSwitch.group);
+		m_QueuedSwitch = SwitchRequest();
+	}
+
+	// 已经在切换到这个分组, 不用排队
+	if (m_Switch.phase != SwitchPhase_None && m_Switch.group == groupName)
+	{
+		if (m_Switch.request == 0)
+		{
+			m_Switch.request = m_NextRequestId++;
+		}
+		return m_Switch.request;
+	}
+
+	m_QueuedSwitch.id = m_NextRequestId++;
+	m_QueuedSwitch.group = groupName;
+	m_QueuedSwitch.requested = StopWatch();
+	m_QueuedSwitch.due = std::chrono::steady_clock::now()
+		+ std::chrono::microseconds((long long)(m_Settings.switch_debounce_ms * 1000.0f));
+
+	return m_QueuedSwitch.id;
+}
+
+void ModeGroupExtension::RunQueuedSwitch()
+{
+	if (m_QueuedSwitch.id == 0 || std::chrono::steady_clock::now() < m_QueuedSwitch.due)
+	{
+		return;
+	}
+
+	// 切换时插件可能发出新的请求, 先从队列里取出
+	SwitchRequest request = m_QueuedSwitch;
+	m_QueuedSwitch = SwitchRequest();
+
+	if (!SwitchModeGroup(request.group.c_str(), false, request.id, &request.requested))
+	{
+		EndSwitchRequest(request.id, SwitchRequest_Failed, request.group);
+	}
+}
+
+void ModeGroupExtension::EndSwitchRequest(int id, SwitchRequestStatus status, const std::string &group)
+{
+	SwitchRequestResult result;
+	result.id = id;
+	result.status = status;
+	result.group = group;
+
+	m_RequestResults.push_back(result);
+	if (m_RequestResults.size() > SWITCH_REQUEST_HISTORY)
+	{
+		m_RequestResults.erase(m_RequestResults.begin());
+	}
+	m_RequestNotices.push_back(result);
+}
+
+SwitchRequestStatus ModeGroupExtension::GetSwitchRequestStatus(int id) const
+{
+	if (id <= 0)
+	{
+		return SwitchRequest_Unknown;
+	}
+	if (id == m_QueuedSwitch.id)
+	{
+		return SwitchRequest_Queued;
+	}
+	if (m_Switch.phase != SwitchPhase_None && id == m_Switch.request)
+	{
+		return SwitchRequest_Running;
+	}
+
+	for (size_t i = m_RequestResults.size(); i-- > 0; )
+	{
+		if (m_RequestResults[i].id == id)
+		{
+			return m_RequestResults[i].status;
+		}
+	}
+	return SwitchRequest_Unknown;
+}
+
+void ModeGroupExtension::NotifySwitchRequests()
+{
+	if (m_RequestNotices.empty())
+	{
+		return;
+	}
+
+	// 回调里可能再发请求, 先把要通知的取出来
+	std::vector<SwitchRequestResult> notices;
+	notices.swap(m_RequestNotices);
+
+	for (size_t i = 0; i < notices.size() && m_pRequestDoneForward; i++)
+	{
+		m_pRequestDoneForward->PushCell(notices[i].id);
+		m_pRequestDoneForward->PushCell(notices[i].status);
+		m_pRequestDoneForward->PushString(notices[i].group.c_str());
+		m_pRequestDoneForward->Execute(NULL);
+	}
+}
+
+void ModeGroupExtension::StartSwitch(const ModeGroup &group, bool forceDelta, bool immediate, int request,
+	const StopWatch *requested)
+{
+	BeginSwitch(group, forceDelta);
+	m_Switch.request = request;
+
+	// 总耗时从请求算起, 包括排队和防抖的等待
+	if (requested)
+	{
+		m_Switch.started = *requested;
+	}
+
+	if (immediate || !m_Settings.incremental_switch)
+	{
+		RunSwitch(0.0f);
+	}
+}
+
+bool ModeGroupExtension::SwitchModeGroupById(int id)
+{
+	const ModeGroup *pGroup = m_ModeGroups->FindById(id);
+	if (!pGroup)
+	{
+		g_pSM->LogError(myself, "Mode group #%d not found", id);
+		return false;
+	}
+
+	return RequestSwitch(m_ModeGroups->GetString(pGroup->name)) != 0;
+}
+
+int ModeGroupExtension::FindModeGroupId(const char *groupName)
+{
+	const ModeGroup *pGroup = m_ModeGroups->Find(groupName);
+	return pGroup ? pGroup->id : INVALID_GROUP_ID;
+}
+
+const char *ModeGroupExtension::GetModeGroupName(int id)
+{
+	const ModeGroup *pGroup = m_ModeGroups->FindById(id);
+	return pGroup ? m_ModeGroups->GetString(pGroup->name) : NULL;
+}
+
+bool ModeGroupExtension::QueueModeGroupSwitch(const char *groupName)
+{
+	const ModeGroup *pGroup = m_ModeGroups->Find(groupName);
+	if (!pGroup)
+	{
+		g_pSM->LogError(myself, "Mode group '%s' not found", groupName);
+		return false;
+	}
+	groupName = m_ModeGroups->GetString(pGroup->name);
+
+	// 只保留最后一次请求
+	if (!m_PendingModeGroup.empty() && m_PendingModeGroup != groupName)
+	{
+		g_pSM->LogMessage(myself, "Replacing deferred switch to %s", m_PendingModeGroup.c_str());
+	}
+
+	m_PendingModeGroup = groupName;
+	g_pSM->LogMessage(myself, "Mode group %s will be switched to at the next map change", groupName);
+
+	return true;
+}
+
+void ModeGroupExtension::BeginSwitch(const ModeGroup &group, bool forceDelta)
+{
+	StopWatch timer;
+	m_Switch.started = timer;
+	m_Switch.stats = SwitchStats();
+	m_Switch.table = m_ModeGroups;
+	m_Switch.group = m_ModeGroups->GetString(group.name);
+	m_Switch.oldGroup = m_CurrentModeGroup;
+
+	// 预热过的分组直接用预热时解析好的计划, 不再检查目录
+	if (m_Prepared.plan && m_Prepared.group == m_Switch.group)
+	{
+		m_Switch.plan = m_Prepared.plan;
+	}
+	else
+	{
+		m_Switch.plan = GetPlan(group);
+	}
+	m_Switch.index = 0;
+	m_Switch.leaving.clear();
+	m_Switch.suspend = false;
+
+	const ModeGroupPlan &plan = *m_Switch.plan;
+
+	// 重新切换到当前分组时不动任何插件, 只重新应用 cvars 和 commands
+	if (m_Switch.oldGroup == m_Switch.group && !forceDelta)
+	{
+		m_Switch.phase = SwitchPhase_Cvars;
+	}
+	else
+	{
+		// 离开的插件先卸载, 两个分组共有的插件保持运行
+		for (size_t i = 0; i < m_LoadedPlugins.size(); i++)
+		{
+			if (!std::binary_search(plan.sorted_plugins.begin(), plan.sorted_plugins.end(), m_LoadedPlugins[i]))
+			{
+				m_Switch.leaving.push_back(m_LoadedPlugins[i]);
+			}
+		}
+
+		// 离开的分组开了 suspend_on_leave 时只暂停它的插件
+		const ModeGroup *pOld = m_ModeGroups->Find(m_Switch.oldGroup.c_str());
+		const ModeGroupTable *oldTable;
+		pOld = pOld ? GetGroupBody(*pOld, oldTable) : NULL;
+		m_Switch.suspend = pOld && pOld->suspend_on_leave;
+
+		// 卸载的同时在工作线程读取并检查要加载的插件文件, 暂停中的插件恢复就行, 不用读
+		std::vector<std::string> joining;
+		for (size_t i = 0; i < plan.plugins.size(); i++)
+		{
+			if ((!std::binary_search(m_LoadedPlugins.begin(), m_LoadedPlugins.end(), plan.plugins[i])
+				|| FindPluginByFile(plan.plugins[i]) == NULL)
+				&& m_Suspended.find(plan.plugins[i]) == m_Suspended.end())
+			{
+				joining.push_back(plan.plugins[i]);
+			}
+		}
+		m_Prefetch.Start(joining);
+
+		m_Switch.phase = SwitchPhase_Unload;
+	}
+
+	m_Switch.cvar_batches = &plan.cvar_batches;
+
+	m_Switch.stats.phase_ms[SwitchStat_Scan] = timer.ElapsedMs();
+}
+
+bool ModeGroupExtension::StepSwitch(bool block)
+{
+	while (m_Switch.phase != SwitchPhase_None)
+	{
+		// 插件加载/卸载时可能调用 ModeGroup_Switch 重置 m_Switch, 这里持有一份计划
+		std::shared_ptr<const ModeGroupPlan> pPlan = m_Switch.plan;
+		const ModeGroupPlan &plan = *pPlan;
+		SwitchPhase phase = m_Switch.phase;
+		size_t i = m_Switch.index++;
+		StopWatch timer;
+
+		switch (phase)
+		{
+		case SwitchPhase_Unload:
+			if (i < m_Switch.leaving.size())
+			{
+				std::string path = m_Switch.leaving[i];
+				if (m_Switch.suspend && SuspendPlugin(path, m_Switch.oldGroup))
+				{
+					SetPluginLoaded(path, false);
+					if (AddSwitchTime(plan, phase, timer.ElapsedMs()))
+					{
+						m_Switch.stats.suspended++;
+					}
+					return true;
+				}
+
+				UnloadPlugin(path.c_str(), m_Switch.oldGroup);
+				SetPluginLoaded(path, false);
+				double ms = timer.ElapsedMs();
+				if (AddSwitchTime(plan, phase, ms))
+				{
+					m_Switch.stats.unloaded++;
+					m_Histograms.RecordUnload(m_Switch.group, ms);
+				}
+				return true;
+			}
+			break;
+		case SwitchPhase_Prefetch:
+			if (!m_Prefetch.IsDone() && !block)
+			{
+				return false;
+			}
+			m_Prefetch.Wait();
+			AddSwitchTime(plan, phase, timer.ElapsedMs());
+			break;
+		case SwitchPhase_Load:
+			if (i < plan.plugins.size())
+			{
+				const std::string &path = plan.plugins[i];
+
+				// 共有的插件如果被管理员手动卸载了, 这里重新加载
+				bool running = std::binary_search(m_LoadedPlugins.begin(), m_LoadedPlugins.end(), path)
+					&& FindPluginByFile(path) != NULL;
+				if (!running && ResumePlugin(path))
+				{
+					SetPluginLoaded(path, true);
+					if (AddSwitchTime(plan, phase, timer.ElapsedMs()))
+					{
+						m_Switch.stats.resumed++;
+					}
+				}
+				else if (!running)
+				{
+					const char *error = m_Prefetch.GetError(path);
+					if (error)
+					{
+						g_pSM->LogError(myself, "Skipping plugin %s: %s", path.c_str(), error);
+						SetPluginLoaded(path, false);
+					}
+					else
+					{
+						bool loaded = LoadPlugin(path.c_str(), m_Switch.group);
+						SetPluginLoaded(path, loaded);
+
+						double ms = timer.ElapsedMs();
+						if (AddSwitchTime(plan, phase, ms) && loaded)
+						{
+							m_Switch.stats.loaded++;
+							m_Switch.stats.AddPluginLoad(path, ms);
+							m_Histograms.RecordLoad(m_Switch.group, ms);
+						}
+					}
+				}
+				return true;
+			}
+			m_Prefetch.Cancel();
+			break;
+		case SwitchPhase_UnloadExtra:
+			// 卸载手动指定的插件
+			if (i < plan.unload_plugins.size())
+			{
+				UnloadPlugin(plan.unload_plugins[i].c_str(), m_Switch.group);
+				double ms = timer.ElapsedMs();
+				if (AddSwitchTime(plan, phase, ms))
+				{
+					m_Histograms.RecordUnload(m_Switch.group, ms);
+				}
+				return true;
+			}
+			break;
+		case SwitchPhase_Cvars:
+			if (i == 0 && !plan.sm_cvar_batches.empty())
+			{
+				// 到这里插件都加载/卸载完了, 切换本身也可能加载或卸载 basecommands.smx
+				// 没有 sm_cvar 时不退回直接设置, 整个 cvar 阶段失败, 请求以失败结束
+				if (!IsSmCvarAvailable())
+				{
+					g_pSM->LogError(myself, "Mode group %s has use_sm_cvar set, but sm_cvar is unavailable (basecommands.smx is not running): "
+						"none of its %zu cvars were set",
+						m_Switch.group.c_str(), plan.cvar_ops.size());
+					m_Switch.cvars_failed = true;
+					AddSwitchTime(plan, phase, timer.ElapsedMs());
+					break;
+				}
+				m_Switch.cvar_batches = &plan.sm_cvar_batches;
+			}
+			if (i < m_Switch.cvar_batches->size())
+			{
+				gamehelpers->ServerCommand((*m_Switch.cvar_batches)[i].c_str());
+				AddSwitchTime(plan, phase, timer.ElapsedMs());
+				return true;
+			}
+			for (size_t j = 0; j < plan.cvar_ops.size(); j++)
+			{
+				g_pSM->LogMessage(myself, "%s", plan.cvar_ops[j].log.c_str());
+			}
+			AddSwitchTime(plan, phase, timer.ElapsedMs());
+			break;
+		case SwitchPhase_Commands:
+			if (i < plan.command_ops.size())
+			{
+				gamehelpers->ServerCommand(plan.command_ops[i].command.c_str());
+				g_pSM->LogMessage(myself, "%s", plan.command_ops[i].log.c_str());
+				AddSwitchTime(plan, phase, timer.ElapsedMs());
+				return true;
+			}
+			break;
+		default:
+			break;
+		}
+
+		m_Switch.phase = (SwitchPhase)(m_Switch.phase + 1);
+		m_Switch.index = 0;
+
+		if (m_Switch.phase == SwitchPhase_Done)
+		{
+			FinishSwitch();
+			return false;
+		}
+	}
+
+	return false;
+}
+
+void ModeGroupExtension::RunSwitch(float budgetMs)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// 每帧至少推进一步, 预算为 0 表示一次做完
+	while (StepSwitch(budgetMs <= 0.0f))
+	{
+		if (budgetMs > 0.0f)
+		{
+			std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			if (elapsed.count() >= budgetMs)
+			{
+				break;
+			}
+		}
+	}
+}
+
+bool ModeGroupExtension::AddSwitchTime(const ModeGroupPlan &plan, SwitchPhase phase, double ms)
+{
+	// 插件加载/卸载时可能已经开始了另一个切换, 那这段时间不算它的
+	if (m_Switch.plan.get() != &plan)
+	{
+		return false;
+	}
+
+	SwitchStatPhase stat;
+	switch (phase)
+	{
+	case SwitchPhase_Unload:
+	case SwitchPhase_UnloadExtra:
+		stat = SwitchStat_Unload;
+		break;
+	case SwitchPhase_Prefetch:
+		stat = SwitchStat_Prefetch;
+		break;
+	case SwitchPhase_Load:
+		stat = SwitchStat_Load;
+		break;
+	case SwitchPhase_Cvars:
+		stat = SwitchStat_Cvars;
+		break;
+	case SwitchPhase_Commands:
+		stat = SwitchStat_Commands;
+		break;
+	default:
+		return true;
+	}
+
+	m_Switch.stats.phase_ms[stat] += ms;
+	return true;
+}
+
+void ModeGroupExtension::FinishSwitch()
+{
+	// 这次要用的插件都恢复了, 再从最早暂停的开始卸载超出上限的部分
+	StopWatch timer;
+	size_t trimmed = TrimSuspendedPlugins(m_Settings.suspend_memory_cap);
+	if (trimmed > 0)
+	{
+		m_Switch.stats.unloaded += trimmed;
+		m_Switch.stats.phase_ms[SwitchStat_Unload] += timer.ElapsedMs();
+	}
+
+	std::string oldGroup = m_Switch.oldGroup;
+	std::string newGroup = m_Switch.group;
+	SwitchStats stats = m_Switch.stats;
+	StopWatch started = m_Switch.started;
+	int request = m_Switch.request;
+	bool failed = m_Switch.cvars_failed;
+	const ModeGroup *pGroup = m_Switch.table->Find(newGroup.c_str());
+	m_CurrentModeGroup = newGroup;
+	m_CurrentModeGroupId = pGroup ? pGroup->id : INVALID_GROUP_ID;
+	m_Switch = SwitchState();
+
+	if (m_Prepared.group == newGroup)
+	{
+		ReleasePreparedGroup();
+	}
+
+	g_pSM->LogMessage(myself, "Switched to mode group: %s", newGroup.c_str());
+
+	if (request != 0)
+	{
+		EndSwitchRequest(request, failed ? SwitchRequest_Failed : SwitchRequest_Done, newGroup);
+	}
+
+	// 回调里可能再次切换分组, 所以先清理切换状态
+	if (m_pModeGroupChangedForward)
+	{
+		StopWatch timer;
+		m_pModeGroupChangedForward->PushString(oldGroup.c_str());
+		m_pModeGroupChangedForward->PushString(newGroup.c_str());
+		m_pModeGroupChangedForward->Execute(NULL);
+		stats.phase_ms[SwitchStat_Forward] = timer.ElapsedMs();
+	}
+
+	stats.from = oldGroup;
+	stats.to = newGroup;
+	stats.wall_ms = started.ElapsedMs();
+	for (int i = 0; i < SwitchStat_Count; i++)
+	{
+		stats.total_ms += stats.phase_ms[i];
+	}
+	m_SwitchStats.Push(stats);
+	m_Histograms.RecordSwitch(newGroup, stats.total_ms);
+}
+
+void ModeGroupExtension::OnGameFrame(bool simulating)
+{
+	// 加载线程做完之后在这一帧换上新表
+	if (m_Load && IsConfigLoadDone())
+	{
+		PublishConfig(NULL, 0);
+	}
+
+	// 这一帧之前的请求只剩最新的一个, 到时间了才开始切换
+	RunQueuedSwitch();
+
+	if (m_Switch.phase != SwitchPhase_None)
+	{
+		RunSwitch(m_Settings.frame_budget_ms);
+	}
+
+	if (!m_Prepared.group.empty() && m_Switch.group != m_Prepared.group
+		&& std::chrono::steady_clock::now() >= m_Prepared.expires)
+	{
+		g_pSM->LogMessage(myself, "Prepared mode group %s timed out", m_Prepared.group.c_str());
+		ReleasePreparedGroup();
+	}
+
+	NotifySwitchRequests();
+}
+
+bool ModeGroupExtension::PrepareModeGroup(const char *groupName)
+{
+	const ModeGroup *pGroup = m_ModeGroups->Find(groupName);
+	if (!pGroup)
+	{
+		g_pSM->LogError(myself, "Mode group '%s' not found", groupName);
+		return false;
+	}
+
+	const ModeGroupTable *table;
+	if (!GetGroupBody(*pGroup, table))
+	{
+		return false;
+	}
+
+	ReleasePreparedGroup();
+
+	m_Prepared.group = m_ModeGroups->GetString(pGroup->name);
+	m_Prepared.table = m_ModeGroups;
+	m_Prepared.plan = GetPlan(*pGroup);
+	m_Prepared.expires = std::chrono::steady_clock::now()
+		+ std::chrono::milliseconds((long long)(m_Settings.prepare_timeout * 1000.0f));
+
+	const ModeGroupPlan &plan = *m_Prepared.plan;
+	char path[PLATFORM_MAX_PATH];
+
+	for (size_t i = 0; i < plan.plugins.size(); i++)
+	{
+		if (FindPluginByFile(plan.plugins[i]) != NULL)
+		{
+			continue;
+		}
+
+		g_pSM->BuildPath(Path_SM, path, sizeof(path), "plugins/%s", plan.plugins[i].c_str());
+		PinFile(path);
+	}
+
+	// commands 里 exec 的配置文件
+	for (size_t i = 0; i < plan.command_ops.size(); i++)
+	{
+		const std::string &cmd = plan.command_ops[i].command;
+		if (cmd.compare(0, 5, "exec ") != 0)
+		{
+			continue;
+		}
+
+		std::string file = cmd.substr(5);
+		file.erase(file.find_last_not_of(" \t\r\n\"") + 1);
+		file.erase(0, file.find_first_not_of(" \t\""));
+		if (file.empty())
+		{
+			continue;
+		}
+		if (file.size() < 4 || file.compare(file.size() - 4, 4, ".cfg") != 0)
+		{
+			file += ".cfg";
+		}
+
+		g_pSM->BuildPath(Path_Game, path, sizeof(path), "cfg/%s", file.c_str());
+		PinFile(path);
+	}
+
+	g_pSM->LogMessage(myself, "Prepared mode group %s: %zu files, %zu KB (%zu KB locked)",
+		m_Prepared.group.c_str(), m_Prepared.files.size(), m_Prepared.bytes / 1024, m_Prepared.locked_bytes / 1024);
+
+	return true;
+}
+
+bool ModeGroupExtension::PinFile(const char *path)
+{
+	std::unique_ptr<MappedFile> file(new MappedFile());
+	if (!file->Open(path))
+	{
+		return false;
+	}
+
+	if (m_Prepared.bytes + file->GetSize() > m_Settings.prepare_memory_cap)
+	{
+		g_pSM->LogError(myself, "Not preparing %s: memory cap of %zu KB reached", path, m_Settings.prepare_memory_cap / 1024);
+		return false;
+	}
+
+	file->Prefault();
+	if (m_Settings.prepare_mlock && file->Lock())
+	{
+		m_Prepared.locked_bytes += file->GetSize();
+	}
+
+	m_Prepared.bytes += file->GetSize();
+	m_Prepared.files.push_back(std::move(file));
+
+	return true;
+}
+
+void ModeGroupExtension::ReleasePreparedGroup()
+{
+	m_Prepared = PreparedGroup();
+}
+
+void ModeGroupExtension::SetPluginLoaded(const std::string &path, bool loaded)
+{
+	std::vector<std::string>::iterator it = std::lower_bound(m_LoadedPlugins.begin(), m_LoadedPlugins.end(), path);
+	bool present = (it != m_LoadedPlugins.end() && *it == path);
+
+	if (loaded && !present)
+	{
+		m_LoadedPlugins.insert(it, path);
+	}
+	else if (!loaded && present)
+	{
+		m_LoadedPlugins.erase(it);
+	}
+}
+
+void ModeGroupExtension::UnloadCurrentModeGroup()
+{
+	m_Switch = SwitchState();
+	m_Prefetch.Cancel();
+
+	TrimSuspendedPlugins(0);
+
+	if (m_CurrentModeGroup.empty() && m_LoadedPlugins.empty())
+		return;
+
+	UnloadPlugins(m_LoadedPlugins, m_CurrentModeGroup);
+
+	m_LoadedPlugins.clear();
+	m_CurrentModeGroup.clear();
+	m_CurrentModeGroupId = INVALID_GROUP_ID;
+}
+
+/**
+ * load_plugins and unload_plugins may leave out the extension, as with
+ * "sm plugins load". Plugins are prefetched, indexed and compared by their
+ * file name, so ".smx" is added here.
+ */
+static std::string GetPluginFileName(const char *name)
+{
+	std::string file = name;
+	size_t base = file.find_last_of("/\\");
+	if (file.find('.', base == std::string::npos ? 0 : base) == std::string::npos)
+	{
+		file += ".smx";
+	}
+	return file;
+}
+
+std::shared_ptr<const ModeGroupPlan> ModeGroupExtension::CompileModeGroup(const ModeGroupTable &table,
+	const ModeGroup &group)
+{
+	std::shared_ptr<ModeGroupPlan> plan = std::make_shared<ModeGroupPlan>();
+
+	// 先取目录版本再扫描, 扫描期间的改动会在下次切换时重新编译
+	const char *dir = table.GetString(group.plugin_directory);
+	plan->dir_stamp = dir[0] == '\0' ? 0 : m_PluginDirs.Stamp(dir);
+
+	CollectGroupPlugins(table, group, plan->plugins);
+	plan->sorted_plugins = plan->plugins;
+	std::sort(plan->sorted_plugins.begin(), plan->sorted_plugins.end());
+
+	const StringId *ids = table.GetIds(group.unload_plugins);
+	for (uint32_t i = 0; i < group.unload_plugins.count; i++)
+	{
+		plan->unload_plugins.push_back(GetPluginFileName(table.GetString(ids[i])));
+	}
+
+	ids = table.GetIds(group.cvars);
+	plan->cvar_ops.reserve(group.cvars.count / 2);
+	for (uint32_t i = 0; i + 1 < group.cvars.count; i += 2)
+	{
+		std::string name = table.GetString(ids[i]);
+		std::string value = table.GetString(ids[i + 1]);
+		ModeGroupOp op;
+		op.command = name + " " + value + "\n";
+		op.log = "Set Cvar " + name + " to " + value;
+		plan->cvar_ops.push_back(op);
+	}
+
+	// cvar 合并成若干不超过 CVAR_BATCH_SIZE 的多行命令, 放不进当前批次的另起一条
+	for (size_t i = 0; i < plan->cvar_ops.size(); i++)
+	{
+		const std::string &line = plan->cvar_ops[i].command;
+		if (plan->cvar_batches.empty() || plan->cvar_batches.back().size() + line.size() > CVAR_BATCH_SIZE)
+		{
+			plan->cvar_batches.push_back(std::string());
+		}
+		plan->cvar_batches.back() += line;
+
+		if (group.use_sm_cvar)
+		{
+			if (plan->sm_cvar_batches.empty() || plan->sm_cvar_batches.back().size() + line.size() + 8 > CVAR_BATCH_SIZE)
+			{
+				plan->sm_cvar_batches.push_back(std::string());
+			}
+			plan->sm_cvar_batches.back() += "sm_cvar ";
+			plan->sm_cvar_batches.back() += line;
+		}
+	}
+
+	ids = table.GetIds(group.commands);
+	plan->command_ops.reserve(group.commands.count / 2);
+	for (uint32_t i = 0; i + 1 < group.commands.count; i += 2)
+	{
+		std::string name = table.GetString(ids[i]);
+		std::string value = table.GetString(ids[i + 1]);
+		ModeGroupOp op;
+		if (name == "command")
+		{
+			op.command = value + "\n";
+			op.log = "Executed Command: " + value;
+		}
+		else
+		{
+			op.command = name + " " + value + "\n";
+			op.log = "Executed Command: " + op.command;
+		}
+		plan->command_ops.push_back(op);
+	}
+
+	return plan;
+}
+
+std::shared_ptr<const ModeGroupPlan> ModeGroupExtension::GetPlan(const ModeGroup &group)
+{
+	ModeGroupState &state = m_GroupStates[m_ModeGroups->IndexOf(group)];
+
+	// 解析失败的分组按空分组编译, 错误已经记录过了
+	const ModeGroupTable *table;
+	const ModeGroup *body = GetGroupBody(group, table);
+	if (!body)
+	{
+		table = m_ModeGroups.get();
+		body = &group;
+	}
+
+	// 编译要扫描插件目录, 用到 libsys, 所以在主线程第一次用到时做
+	const char *dir = table->GetString(body->plugin_directory);
+	if (!state.plan || (dir[0] != '\0' && m_PluginDirs.Stamp(dir) != state.plan->dir_stamp))
+	{
+		state.plan = CompileModeGroup(*table, *body);
+	}
+
+	return state.plan;
+}
+
+void ModeGroupExtension::CollectGroupPlugins(const ModeGroupTable &table, const ModeGroup &group,
+	std::vector<std::string> &plugins)
+{
+	const char *dir = table.GetString(group.plugin_directory);
+	if (dir[0] != '\0')
+	{
+		ScanDirectoryForPlugins(dir, plugins);
+	}
+
+	// 加载手动指定的插件
+	const StringId *ids = table.GetIds(group.load_plugins);
+	for (uint32_t i = 0; i < group.load_plugins.count; i++)
+	{
+		plugins.push_back(GetPluginFileName(table.GetString(ids[i])));
+	}
+
+	// 目录和 load_plugins 可能重复, 保留第一次出现的位置
+	std::set<std::string> seen;
+	std::vector<std::string>::iterator out = plugins.begin();
+	for (std::vector<std::string>::iterator in = plugins.begin(); in != plugins.end(); ++in)
+	{
+		if (seen.insert(*in).second)
+		{
+			*out++ = *in;
+		}
+	}
+	plugins.erase(out, plugins.end());
+}
+
+bool ModeGroupExtension::IsSmCvarAvailable()
+{
+	// sm_cvar 由 basecommands.smx 注册
+	IPlugin *pPlugin = FindPluginByFile("basecommands.smx");
+	return pPlugin && pPlugin->GetStatus() == Plugin_Running;
+}
+
+void ModeGroupExtension::ScanDirectoryForPlugins(const char *path, std::vector<std::string> &plugins)
+{
+	m_PluginDirs.Collect(path, plugins);
+}
+
+bool ModeGroupExtension::LoadPlugin(const char *path, const std::string &group)
+{
+	char error[256];
+	bool wasloaded;
+	CostMeter meter;
+	IPlugin *pPlugin = plsys->LoadPlugin(path, false, PluginType_MapUpdated, error, sizeof(error), &wasloaded);
+	if (!pPlugin)
+	{
+		g_pSM->LogError(myself, "Failed to load plugin %s: %s", path, error);
+		return false;
+	}
+
+	// 已经在运行的插件没有真正加载, 不计入
+	if (!wasloaded)
+	{
+		PluginCost cost;
+		meter.Stop(cost);
+		IPluginRuntime *pRuntime = pPlugin->GetRuntime();
+		cost.mem_bytes = pRuntime ? (int64_t)pRuntime->GetMemUsage() : 0;
+		m_Profiler.RecordLoad(path, group, cost);
+
+		g_pSM->LogMessage(myself, "Loaded plugin: %s (%.2f ms, %.2f ms CPU, %lld KB)", path,
+			cost.wall_ms, cost.cpu_ms, (long long)(cost.mem_bytes / 1024));
+	}
+	else
+	{
+		g_pSM->LogMessage(myself, "Loaded plugin: %s", path);
+	}
+	return true;
+}
+
+void ModeGroupExtension::UnloadPlugin(const char *path, const std::string &group)
+{
+	bool suspended = ForgetSuspendedPlugin(path);
+
+	IPlugin *pPlugin = FindPluginByFile(path);
+	if (!pPlugin)
+	{
+		return;
+	}
+
+	// 被 suspend_on_leave 暂停的插件也是本扩展加载的, 一样卸载
+	PluginStatus status = pPlugin->GetStatus();
+	if (status != Plugin_Running && !(suspended && status == Plugin_Paused))
+	{
+		return;
+	}
+
+	// 卸载之后插件对象就没了, 先取内存占用
+	IPluginRuntime *pRuntime = pPlugin->GetRuntime();
+	int64_t mem = pRuntime ? (int64_t)pRuntime->GetMemUsage() : 0;
+
+	CostMeter meter;
+	if (!plsys->UnloadPlugin(pPlugin))
+	{
+		g_pSM->LogError(myself, "Failed to unload plugin %s", path);
+		return;
+	}
+
+	PluginCost cost;
+	meter.Stop(cost);
+	cost.mem_bytes = -mem;
+	m_Profiler.RecordUnload(path, group, cost);
+
+	g_pSM->LogMessage(myself, "Unloaded plugin: %s (%.2f ms, %.2f ms CPU)", path, cost.wall_ms, cost.cpu_ms);
+}
+
+void ModeGroupExtension::UnloadPlugins(const std::vector<std::string> &paths, const std::string &group)
+{
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		UnloadPlugin(paths[i].c_str(), group);
+	}
+}
+
+bool ModeGroupExtension::SuspendPlugin(const std::string &path, const std::string &group)
+{
+	IPlugin *pPlugin = FindPluginByFile(path);
+	if (!pPlugin || pPlugin->GetStatus() != Plugin_Running || !pPlugin->SetPauseState(true))
+	{
+		return false;
+	}
+
+	// 管理员手动恢复过的插件还留着上次暂停的记录, 先去掉
+	ForgetSuspendedPlugin(path);
+
+	IPluginRuntime *pRuntime = pPlugin->GetRuntime();
+	SuspendedPlugin &suspended = m_Suspended[path];
+	suspended.group = group;
+	suspended.bytes = pRuntime ? pRuntime->GetMemUsage() : 0;
+	suspended.stamp = ++m_SuspendStamp;
+	m_SuspendedBytes += suspended.bytes;
+	m_SuspendOrder[suspended.stamp] = path;
+
+	g_pSM->LogMessage(myself, "Suspended plugin: %s (%zu KB)", path.c_str(), suspended.bytes / 1024);
+	return true;
+}
+
+bool ModeGroupExtension::ResumePlugin(const std::string &path)
+{
+	std::unordered_map<std::string, SuspendedPlugin>::iterator it = m_Suspended.find(path);
+	if (it == m_Suspended.end())
+	{
+		return false;
+	}
+	std::string group = it->second.group;
+
+	// 管理员可能已经手动恢复了这个插件
+	IPlugin *pPlugin = FindPluginByFile(path);
+	if (pPlugin && pPlugin->GetStatus() == Plugin_Paused)
+	{
+		pPlugin->SetPauseState(false);
+	}
+
+	// 恢复成功才不再记为暂停
+	if (pPlugin && pPlugin->GetStatus() == Plugin_Running)
+	{
+		ForgetSuspendedPlugin(path);
+		g_pSM->LogMessage(myself, "Resumed plugin: %s", path.c_str());
+		return true;
+	}
+
+	// 恢复失败时先卸载还暂停着的插件, 调用方再重新加载
+	g_pSM->LogError(myself, "Failed to resume plugin %s, loading it again", path.c_str());
+	if (pPlugin)
+	{
+		UnloadPlugin(path.c_str(), group);
+	}
+	ForgetSuspendedPlugin(path);
+	return false;
+}
+
+bool ModeGroupExtension::ForgetSuspendedPlugin(const std::string &path)
+{
+	std::unordered_map<std::string, SuspendedPlugin>::iterator it = m_Suspended.find(path);
+	if (it == m_Suspended.end())
+	{
+		return false;
+	}
+
+	m_SuspendedBytes -= it->second.bytes;
+	m_SuspendOrder.erase(it->second.stamp);
+	m_Suspended.erase(it);
+	return true;
+}
+
+size_t ModeGroupExtension::TrimSuspendedPlugins(size_t cap)
+{
+	size_t unloaded = 0;
+	while (m_SuspendedBytes > cap && !m_SuspendOrder.empty())
+	{
+		// 按暂停的先后排好了, 最前面的就是最久没用的
+		std::string path = m_SuspendOrder.begin()->second;
+		std::string group = m_Suspended[path].group;
+		UnloadPlugin(path.c_str(), group);
+
+		// 卸载失败时插件还在, 也不再当作暂停中, 否则会一直重试同一个
+		ForgetSuspendedPlugin(path);
+		unloaded++;
+	}
+	return unloaded;
+}
+
+IPlugin *ModeGroupExtension::FindPluginByFile(const std::string &path)
+{
+	std::unordered_map<std::string, IPlugin *>::iterator it = m_PluginsByFile.find(path);
+	if (it == m_PluginsByFile.end())
+	{
+		return NULL;
+	}
+
+	return it->second;
+}
+
+void ModeGroupExtension::OnPluginCreated(IPlugin *plugin)
+{
+	m_PluginsByFile[plugin->GetFilename()] = plugin;
+}
+
+void ModeGroupExtension::OnPluginLoaded(IPlugin *plugin)
+{
+	m_PluginsByFile[plugin->GetFilename()] = plugin;
+}
+
+void ModeGroupExtension::OnPluginDestroyed(IPlugin *plugin)
+{
+	// 包括管理员手动执行 sm plugins unload 的情况
+	std::unordered_map<std::string, IPlugin *>::iterator it = m_PluginsByFile.find(plugin->GetFilename());
+	if (it != m_PluginsByFile.end() && it->second == plugin)
+	{
+		m_PluginsByFile.erase(it);
+		ForgetSuspendedPlugin(plugin->GetFilename());
+	}
+}
+
+void ModeGroupExtension::ReloadConfig()
+{
+	// 解析在加载线程进行, 新表在之后的一帧换上, 在那之前旧配置继续生效
+	if (!m_Load)
+	{
+		g_pSM->LogMessage(myself, "Reloading configuration in the background");
+	}
+	StartConfigLoad(true);
+}
+
+void ModeGroupExtension::DiffConfig(ConfigLoad &load)
+{
+	const ModeGroupTable &groups = *load.groups;
+	load.kept.assign(groups.Count(), -1);
+	load.changed = groups.Count();
+	load.removed = 0;
+	if (!load.old_groups)
+	{
+		return;
+	}
+
+	// 旧表已经发布, 谁都不会再修改, 加载线程可以直接读
+	const ModeGroupTable &oldGroups = *load.old_groups;
+	for (size_t i = 0; i < groups.Count(); i++)
+	{
+		const ModeGroup &group = groups.Get(i);
+		const ModeGroup *old = oldGroups.Find(groups.GetString(group.name));
+		if (old && IsUnchangedModeGroup(oldGroups, *old, groups, group))
+		{
+			load.kept[i] = (int)oldGroups.IndexOf(*old);
+			load.changed--;
+		}
+	}
+
+	for (size_t i = 0; i < oldGroups.Count(); i++)
+	{
+		if (!groups.Find(oldGroups.GetString(oldGroups.Get(i).name)))
+		{
+			load.removed++;
+		}
+	}
+}
+
+void ModeGroupExtension::ApplyReloadedConfig(ConfigLoad &load)
+{
+	// 没有变化的分组沿用旧的计划和解析结果, 修改过的分组在下次用到时重新编译
+	std::vector<ModeGroupState> states(load.groups->Count());
+	if (load.old_groups == m_ModeGroups)
+	{
+		for (size_t i = 0; i < states.size(); i++)
+		{
+			if (load.kept[i] >= 0)
+			{
+				states[i] = m_GroupStates[load.kept[i]];
+			}
+		}
+	}
+
+	bool activeChanged = false;
+	if (!m_CurrentModeGroup.empty())
+	{
+		const ModeGroup *pGroup = load.groups->Find(m_CurrentModeGroup.c_str());
+		if (!pGroup)
+		{
+			g_pSM->LogError(myself, "Active mode group %s was removed from the configuration, its plugins stay loaded",
+				m_CurrentModeGroup.c_str());
+		}
+		else
+		{
+			activeChanged = load.kept[load.groups->IndexOf(*pGroup)] < 0;
+		}
+	}
+
+	// 发布新表只换一个指针, 旧表等正在进行的切换和预热的分组放开后才释放
+	m_ModeGroups = load.groups;
+	m_GroupStates.swap(states);
+	m_Settings = load.settings;
+	m_ConfigHash = load.hash;
+
+	if (!m_Prepared.group.empty())
+	{
+		const ModeGroup *pGroup = m_ModeGroups->Find(m_Prepared.group.c_str());
+		if (!pGroup || m_GroupStates[m_ModeGroups->IndexOf(*pGroup)].plan != m_Prepared.plan)
+		{
+			ReleasePreparedGroup();
+		}
+	}
+
+	if (!m_PendingModeGroup.empty() && !m_ModeGroups->Find(m_PendingModeGroup.c_str()))
+	{
+		g_pSM->LogError(myself, "Dropping deferred switch to removed mode group %s", m_PendingModeGroup.c_str());
+		m_PendingModeGroup.clear();
+	}
+
+	if (m_QueuedSwitch.id != 0 && !m_ModeGroups->Find(m_QueuedSwitch.group.c_str()))
+	{
+		g_pSM->LogError(myself, "Dropping switch request #%d to removed mode group %s",
+			m_QueuedSwitch.id, m_QueuedSwitch.group.c_str());
+		EndSwitchRequest(m_QueuedSwitch.id, SwitchRequest_Failed, m_QueuedSwitch.group);
+		m_QueuedSwitch = SwitchRequest();
+	}
+
+	g_pSM->LogMessage(myself, "Configuration reloaded successfully (%zu groups, %zu changed, %zu removed, parsed in %.1f ms off the main thread)",
+		m_ModeGroups->Count(), load.changed, load.removed, load.ms);
+
+	if (m_Switch.phase != SwitchPhase_None)
+	{
+		// 正在切换的目标分组被修改时, 从当前进度按新计划重新开始
+		std::string target = m_Switch.group;
+		const ModeGroup *pGroup = m_ModeGroups->Find(target.c_str());
+		if (!pGroup)
+		{
+			g_pSM->LogError(myself, "Abandoning switch to removed mode group %s", target.c_str());
+			if (m_Switch.request != 0)
+			{
+				EndSwitchRequest(m_Switch.request, SwitchRequest_Failed, target);
+			}
+			m_Switch = SwitchState();
+			m_Prefetch.Cancel();
+		}
+		else if (m_GroupStates[m_ModeGroups->IndexOf(*pGroup)].plan != m_Switch.plan)
+		{
+			int request = m_Switch.request;
+			StopWatch started = m_Switch.started;
+			m_Switch = SwitchState();
+			StartSwitch(*pGroup, true, false, request, &started);
+		}
+	}
+	else if (activeChanged)
+	{
+		// 只应用当前分组前后的差异
+		g_pSM->LogMessage(myself, "Applying changes to active mode group %s", m_CurrentModeGroup.c_str());
+		StartSwitch(*m_ModeGroups->Find(m_CurrentModeGroup.c_str()), true, false, 0, NULL);
+	}
+}
+
+void ModeGroupExtension::ListModeGroups()
+{
+	// 表里按配置文件的顺序存放, 列出时按名字排序
+	std::vector<std::pair<std::string, int>> names;
+	names.reserve(m_ModeGroups->Count());
+	for (size_t i = 0; i < m_ModeGroups->Count(); i++)
+	{
+		const ModeGroup &group = m_ModeGroups->Get(i);
+		names.push_back(std::make_pair(std::string(m_ModeGroups->GetString(group.name)), group.id));
+	}
+	std::sort(names.begin(), names.end());
+
+	rootconsole->ConsolePrint("Available mode groups:");
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		rootconsole->ConsolePrint("  - %s (id %d)", names[i].first.c_str(), names[i].second);
+	}
+}
+
+void ModeGroupExtension::CurrentModeGroup()
+{
+	if (m_CurrentModeGroup.empty())
+	{
+		rootconsole->ConsolePrint("No mode group currently active");
+	}
+	else
+	{
+		rootconsole->ConsolePrint("Current mode group: %s", m_CurrentModeGroup.c_str());
+	}
+
+	if (!m_PendingModeGroup.empty())
+	{
+		rootconsole->ConsolePrint("Pending at map change: %s", m_PendingModeGroup.c_str());
+	}
+
+	if (!m_Suspended.empty())
+	{
+		rootconsole->ConsolePrint("Suspended: %zu plugins, %zu KB", m_Suspended.size(), m_SuspendedBytes / 1024);
+	}
+
+	if (m_QueuedSwitch.id != 0)
+	{
+		rootconsole->ConsolePrint("Queued: %s (request #%d)", m_QueuedSwitch.group.c_str(), m_QueuedSwitch.id);
+	}
+
+	if (m_Switch.phase != SwitchPhase_None)
+	{
+		static const char *phases[] = { "", "unloading plugins", "reading plugin files", "loading plugins", "unloading plugins", "applying cvars", "executing commands" };
+		rootconsole->ConsolePrint("Switching to: %s (%s)", m_Switch.group.c_str(), phases[m_Switch.phase]);
+	}
+
+	if (!m_Prepared.group.empty())
+	{
+		rootconsole->ConsolePrint("Prepared: %s (%zu files, %zu KB)", m_Prepared.group.c_str(),
+			m_Prepared.files.size(), m_Prepared.bytes / 1024);
+	}
+}
+
+const SwitchStats *ModeGroupExtension::GetSwitchStats(size_t index) const
+{
+	if (index >= m_SwitchStats.Count())
+	{
+		return NULL;
+	}
+	return &m_SwitchStats.Get(index);
+}
+
+void ModeGroupExtension::ShowSwitchStats(size_t index)
+{
+	if (m_SwitchStats.Count() == 0)
+	{
+		rootconsole->ConsolePrint("No mode group switch recorded yet");
+		return;
+	}
+
+	rootconsole->ConsolePrint("Recent switches (newest first):");
+	for (size_t i = 0; i < m_SwitchStats.Count(); i++)
+	{
+		const SwitchStats &stats = m_SwitchStats.Get(i);
+		rootconsole->ConsolePrint("  #%-2zu %s -> %s: %.2f ms (wall %.2f ms), %zu loaded, %zu unloaded, %zu resumed, %zu suspended",
+			i + 1, stats.from.empty() ? "(none)" : stats.from.c_str(), stats.to.c_str(),
+			stats.total_ms, stats.wall_ms, stats.loaded, stats.unloaded, stats.resumed, stats.suspended);
+	}
+
+	const SwitchStats *stats = GetSwitchStats(index);
+	if (!stats)
+	{
+		rootconsole->ConsolePrint("Switch #%zu is not recorded", index + 1);
+		return;
+	}
+
+	rootconsole->ConsolePrint("Switch #%zu phases:", index + 1);
+	for (int i = 0; i < SwitchStat_Count; i++)
+	{
+		rootconsole->ConsolePrint("  %-10s %9.2f ms", SwitchStats::GetPhaseName((SwitchStatPhase)i), stats->phase_ms[i]);
+	}
+
+	if (stats->slowest_count > 0)
+	{
+		rootconsole->ConsolePrint("Slowest plugin loads:");
+		for (size_t i = 0; i < stats->slowest_count; i++)
+		{
+			rootconsole->ConsolePrint("  %9.2f ms  %s", stats->slowest[i].ms, stats->slowest[i].plugin.c_str());
+		}
+	}
+}
+
+const char *ModeGroupExtension::GetConfigGroupName(const char *groupName)
+{
+	// 统计按切换时配置里的写法记录, 参数先换成配置里的写法
+	const ModeGroup *pGroup = m_ModeGroups->Find(groupName);
+	return pGroup ? m_ModeGroups->GetString(pGroup->name) : groupName;
+}
+
+void ModeGroupExtension::ShowHistograms(const char *groupName)
+{
+	if (groupName)
+	{
+		groupName = GetConfigGroupName(groupName);
+	}
+
+	const std::map<std::string, GroupLatency> &groups = m_Histograms.GetGroups();
+	if (groups.empty())
+	{
+		rootconsole->ConsolePrint("No mode group switch recorded yet");
+		return;
+	}
+
+	static const char *kinds[] = { "switch", "load", "unload" };
+
+	rootconsole->ConsolePrint("%-20s %-7s %8s %9s %9s %9s %9s", "group", "kind", "count", "p50 ms", "p90 ms", "p99 ms", "max ms");
+	for (std::map<std::string, GroupLatency>::const_iterator it = groups.begin(); it != groups.end(); ++it)
+	{
+		// 配置改过大小写时, 以前记录的数据也算同一个分组
+		if (groupName && strcasecmp(it->first.c_str(), groupName) != 0)
+		{
+			continue;
+		}
+
+		const LatencyHistogram *histograms[] = { &it->second.total, &it->second.load, &it->second.unload };
+		for (int i = 0; i < 3; i++)
+		{
+			const LatencyHistogram &h = *histograms[i];
+			if (h.Count() == 0)
+			{
+				continue;
+			}
+
+			rootconsole->ConsolePrint("%-20s %-7s %8llu %9.2f %9.2f %9.2f %9.2f", it->first.c_str(), kinds[i],
+				(unsigned long long)h.Count(), h.Percentile(50.0), h.Percentile(90.0), h.Percentile(99.0), h.Max());
+		}
+	}
+}
+
+void ModeGroupExtension::ShowProfile(const char *groupName)
+{
+	if (groupName)
+	{
+		groupName = GetConfigGroupName(groupName);
+	}
+
+	std::vector<std::pair<std::string, const PluginProfile *>> ranking;
+	m_Profiler.GetRanking(groupName, ranking);
+	if (ranking.empty())
+	{
+		if (groupName)
+		{
+			rootconsole->ConsolePrint("No plugin load recorded for mode group: %s", groupName);
+		}
+		else
+		{
+			rootconsole->ConsolePrint("No plugin load recorded yet");
+		}
+		return;
+	}
+
+	rootconsole->ConsolePrint("%6s %9s %9s %9s %6s %9s %8s  %s", "loads", "load ms", "max ms", "cpu ms",
+		"unlds", "unload ms", "mem KB", "plugin");
+	for (size_t i = 0; i < ranking.size(); i++)
+	{
+		const PluginProfile &profile = *ranking[i].second;
+		rootconsole->ConsolePrint("%6llu %9.2f %9.2f %9.2f %6llu %9.2f %8lld  %s",
+			(unsigned long long)profile.load.count, profile.load.AverageWallMs(), profile.load.MaxWallMs(),
+			profile.load.AverageCpuMs(), (unsigned long long)profile.unload.count, profile.unload.AverageWallMs(),
+			(long long)(profile.mem_bytes / 1024), ranking[i].first.c_str());
+	}
+}
 
 const char *ModeGroupExtension::GetCurrentModeGroupName()
 {
@@ -475,28 +2539,69 @@ const char *ModeGroupExtension::GetCurrentModeGroupName()
 
 void ModeGroupExtension::OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args)
 {
+	// 不等到下一帧, 加载已经完成的话先换上新表
+	if (m_Load && IsConfigLoadDone())
+	{
+		PublishConfig(NULL, 0);
+	}
+
 	if (args->ArgC() == 2)
 	{
 		rootconsole->ConsolePrint("Mode Group Manager Menu:");
 		rootconsole->ConsolePrint("Usage: sm modegroup [arguments]");
 		rootconsole->ConsolePrint("    switch              - Switch to a mode group");
-		rootconsole->ConsolePrint("    reload              - Reload mode group configuration");
+		rootconsole->ConsolePrint("    prepare             - Pre-load a mode group's files before switching");
+		rootconsole->ConsolePrint("    reload              - Reload mode group configuration in the background");
 		rootconsole->ConsolePrint("    list                - List available mode groups");
 		rootconsole->ConsolePrint("    current             - Show current mode group");
+		rootconsole->ConsolePrint("    stats               - Show timings of recent switches");
+		rootconsole->ConsolePrint("    stats histogram     - Show switch latency percentiles per group");
+		rootconsole->ConsolePrint("    profile             - Show plugin load and unload costs, most expensive first");
 		return;
 	}
 	else if (args->ArgC() >= 3)
 	{
 		const char *subcmd = args->Arg(2);
 		if (strcmp(subcmd, "switch") == 0)
+		{
+			const char *groupName = NULL;
+			bool atMapChange = false;
+			for (int i = 3; i < args->ArgC(); i++)
+			{
+				if (strcmp(args->Arg(i), "--at-mapchange") == 0)
+				{
+					atMapChange = true;
+				}
+				else
+				{
+					groupName = args->Arg(i);
+				}
+			}
+
+			if (!groupName)
+			{
+				rootconsole->ConsolePrint("Usage: sm modegroup switch <groupname> [--at-mapchange]");
+				return;
+			}
+
+			if (atMapChange)
+			{
+				QueueModeGroupSwitch(groupName);
+			}
+			else
+			{
+				RequestSwitch(groupName);
+			}
+		}
+		else if (strcmp(subcmd, "prepare") == 0)
 		{
 			if (args->ArgC() < 4)
 			{
-				rootconsole->ConsolePrint("Usage: sm modegroup switch <groupname>");
+				rootconsole->ConsolePrint("Usage: sm modegroup prepare <groupname>");
 				return;
 			}
-			
-			SwitchModeGroup(args->Arg(3));
+
+			PrepareModeGroup(args->Arg(3));
 		}
 		else if (strcmp(subcmd, "reload") == 0)
 		{
@@ -510,6 +2615,20 @@ void ModeGroupExtension::OnRootConsoleCommand(const char *cmdname, const IComman
 		{
 			CurrentModeGroup();
 		}
+		else if (strcmp(subcmd, "stats") == 0 && args->ArgC() >= 4 && strcmp(args->Arg(3), "histogram") == 0)
+		{
+			ShowHistograms(args->ArgC() >= 5 ? args->Arg(4) : NULL);
+		}
+		else if (strcmp(subcmd, "stats") == 0)
+		{
+			// 可以指定看第几次切换的详细时间, 1 是最近一次
+			int index = args->ArgC() >= 4 ? atoi(args->Arg(3)) : 1;
+			ShowSwitchStats(index > 0 ? (size_t)(index - 1) : 0);
+		}
+		else if (strcmp(subcmd, "profile") == 0)
+		{
+			ShowProfile(args->ArgC() >= 4 ? args->Arg(3) : NULL);
+		}
 	}
 }
 
@@ -518,7 +2637,36 @@ cell_t Native_SwitchModeGroup(IPluginContext *pContext, const cell_t *params)
 	char *groupName;
 	pContext->LocalToString(params[1], &groupName);
 
-	return g_ModeGroupExtension.SwitchModeGroup(groupName) ? 1 : 0;
+	return g_ModeGroupExtension.RequestSwitch(groupName) != 0 ? 1 : 0;
+}
+
+cell_t Native_RequestSwitch(IPluginContext *pContext, const cell_t *params)
+{
+	char *groupName;
+	pContext->LocalToString(params[1], &groupName);
+
+	return g_ModeGroupExtension.RequestSwitch(groupName);
+}
+
+cell_t Native_GetRequestStatus(IPluginContext *pContext, const cell_t *params)
+{
+	return g_ModeGroupExtension.GetSwitchRequestStatus(params[1]);
+}
+
+cell_t Native_SwitchModeGroupAtMapChange(IPluginContext *pContext, const cell_t *params)
+{
+	char *groupName;
+	pContext->LocalToString(params[1], &groupName);
+
+	return g_ModeGroupExtension.QueueModeGroupSwitch(groupName) ? 1 : 0;
+}
+
+cell_t Native_PrepareModeGroup(IPluginContext *pContext, const cell_t *params)
+{
+	char *groupName;
+	pContext->LocalToString(params[1], &groupName);
+
+	return g_ModeGroupExtension.PrepareModeGroup(groupName) ? 1 : 0;
 }
 
 cell_t Native_GetCurrentModeGroup(IPluginContext *pContext, const cell_t *params)
@@ -529,16 +2677,100 @@ cell_t Native_GetCurrentModeGroup(IPluginContext *pContext, const cell_t *params
 	return 1;
 }
 
+cell_t Native_FindModeGroupByName(IPluginContext *pContext, const cell_t *params)
+{
+	char *groupName;
+	pContext->LocalToString(params[1], &groupName);
+
+	return g_ModeGroupExtension.FindModeGroupId(groupName);
+}
+
+cell_t Native_SwitchModeGroupById(IPluginContext *pContext, const cell_t *params)
+{
+	return g_ModeGroupExtension.SwitchModeGroupById(params[1]) ? 1 : 0;
+}
+
+cell_t Native_GetCurrentModeGroupId(IPluginContext *pContext, const cell_t *params)
+{
+	return g_ModeGroupExtension.GetCurrentModeGroupId();
+}
+
+cell_t Native_GetModeGroupName(IPluginContext *pContext, const cell_t *params)
+{
+	const char *name = g_ModeGroupExtension.GetModeGroupName(params[1]);
+	if (!name)
+	{
+		return 0;
+	}
+
+	char *buffer;
+	pContext->LocalToString(params[2], &buffer);
+	ke::SafeStrcpy(buffer, params[3], name);
+	return 1;
+}
+
 cell_t Native_ReloadConfig(IPluginContext *pContext, const cell_t *params)
 {
 	g_ModeGroupExtension.ReloadConfig();
 	return 1;
 }
 
+cell_t Native_GetLastSwitchStats(IPluginContext *pContext, const cell_t *params)
+{
+	const SwitchStats *stats = g_ModeGroupExtension.GetSwitchStats(0);
+	if (!stats)
+	{
+		return -1;
+	}
+
+	cell_t *totalMs, *wallMs, *phaseMs, *slowestMs;
+	char *slowest;
+	pContext->LocalToPhysAddr(params[1], &totalMs);
+	pContext->LocalToPhysAddr(params[2], &wallMs);
+	pContext->LocalToPhysAddr(params[3], &phaseMs);
+	pContext->LocalToString(params[5], &slowest);
+	pContext->LocalToPhysAddr(params[7], &slowestMs);
+
+	*totalMs = sp_ftoc((float)stats->total_ms);
+	*wallMs = sp_ftoc((float)stats->wall_ms);
+	for (cell_t i = 0; i < params[4] && i < SwitchStat_Count; i++)
+	{
+		phaseMs[i] = sp_ftoc((float)stats->phase_ms[i]);
+	}
+
+	// 插件名用换行分隔
+	std::string names;
+	cell_t count = 0;
+	for (size_t i = 0; i < stats->slowest_count && count < params[8]; i++, count++)
+	{
+		if (i > 0)
+		{
+			names += '\n';
+		}
+		names += stats->slowest[i].plugin;
+		slowestMs[i] = sp_ftoc((float)stats->slowest[i].ms);
+	}
+	if (params[6] > 0)
+	{
+		ke::SafeStrcpy(slowest, params[6], names.c_str());
+	}
+
+	return count;
+}
+
 sp_nativeinfo_t g_Natives[] = 
 {
 	{"ModeGroup_Switch",			Native_SwitchModeGroup},
+	{"ModeGroup_SwitchAtMapChange",	Native_SwitchModeGroupAtMapChange},
+	{"ModeGroup_Prepare",			Native_PrepareModeGroup},
 	{"ModeGroup_GetCurrent",		Native_GetCurrentModeGroup},
 	{"ModeGroup_ReloadConfig",		Native_ReloadConfig},
+	{"ModeGroup_GetLastSwitchStats",	Native_GetLastSwitchStats},
+	{"ModeGroup_FindByName",		Native_FindModeGroupByName},
+	{"ModeGroup_SwitchById",		Native_SwitchModeGroupById},
+	{"ModeGroup_GetCurrentId",		Native_GetCurrentModeGroupId},
+	{"ModeGroup_GetName",			Native_GetModeGroupName},
+	{"ModeGroup_RequestSwitch",		Native_RequestSwitch},
+	{"ModeGroup_GetRequestStatus",	Native_GetRequestStatus},
 	{NULL,							NULL}
 };
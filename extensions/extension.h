@@ -7,51 +7,355 @@
  */
 
 #include "smsdk_ext.h"
+#include "dirindex.h"
+#include "prefetch.h"
+#include "mappedfile.h"
+#include "switchstats.h"
+#include "pluginprofile.h"
+#include "grouptable.h"
+#include "configfiles.h"
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <thread>
 
-struct ModeGroup
+/**
+ * A server command prepared at config load. The text already ends with a
+ * newline and goes to ServerCommand() unchanged.
+ */
+struct ModeGroupOp
 {
-	std::string name;
-	std::string plugin_directory;
-	std::vector<std::string> plugin_files;
-	std::vector<std::string> load_plugins;
+	std::string command;
+	std::string log;
+};
+
+/**
+ * Everything a switch needs, resolved once by CompileModeGroup(). A plan is
+ * never modified after it is built; when the group's plugin_directory
+ * changes on disk a new plan replaces it.
+ */
+struct ModeGroupPlan
+{
+	std::vector<std::string> plugins;        // load order
+	std::vector<std::string> sorted_plugins; // same set, sorted for lookups
 	std::vector<std::string> unload_plugins;
-	bool use_sm_cvar;
-	std::map<std::string, std::string> cvars;
-	std::map<std::string, std::string> commands;
+	std::vector<ModeGroupOp> cvar_ops;       // one plain "name value" line per cvar
+	std::vector<std::string> cvar_batches;   // cvar_ops joined into few ServerCommand() calls
+	std::vector<std::string> sm_cvar_batches; // same through sm_cvar, empty unless use_sm_cvar
+	std::vector<ModeGroupOp> command_ops;
+	unsigned int dir_stamp;
+};
+
+/**
+ * What the main thread learns about a group of the live table after the
+ * table is published. The table itself is never modified, so the body of a
+ * lazy group and the compiled plan are kept here, at the group's index.
+ */
+struct ModeGroupState
+{
+	std::shared_ptr<const ModeGroupTable> body; // a lazy group parsed on first use, as its only group
+	std::shared_ptr<const ModeGroupPlan> plan;
 };
 
-class ModeGroupExtension : public SDKExtension, public IRootConsoleCommand
+/**
+ * Global options from the "Settings" section of modegroup.cfg.
+ */
+struct ModeGroupSettings
+{
+	ModeGroupSettings();
+
+	bool incremental_switch; // spread switches over several frames
+	float frame_budget_ms;   // time a switch may use per frame
+	float prepare_timeout;   // seconds a prepared group stays pinned
+	bool prepare_mlock;      // lock prepared files in memory
+	size_t prepare_memory_cap; // bytes a prepared group may pin
+	bool lazy_parse;         // only index the groups at load, parse each on first use
+	float switch_debounce_ms; // time a switch request waits for a newer one
+	size_t suspend_memory_cap; // bytes suspended plugins may keep before the oldest are unloaded
+};
+
+/**
+ * A log line written on the loader thread, logged by the main thread when
+ * the load is published.
+ */
+struct ConfigMessage
+{
+	bool error;
+	std::string text;
+};
+
+/**
+ * One load of modegroup.cfg and configs/modegroups on the loader thread.
+ * The main thread fills in the input and starts the thread, then leaves
+ * this object and the extension's ConfigDirectory and GroupIdRegistry alone
+ * until done is set. The table is complete, with its IDs assigned and
+ * compared against the live one, when it is handed over; the main thread
+ * publishes it by swapping one pointer.
+ */
+struct ConfigLoad
+{
+	ConfigLoad();
+
+	bool reload;
+	std::string path;       // configs/modegroup.cfg
+	std::string cache_path; // data/modegroup.cache
+	uint64_t old_hash;      // of the live modegroup.cfg
+	bool old_lazy;          // lazy_parse of the live config
+	bool files_listed;      // files were added to or removed from configs/modegroups
+	std::shared_ptr<const ModeGroupTable> old_groups; // the live table, read but never changed here
+
+	std::shared_ptr<ModeGroupTable> groups;
+	ModeGroupSettings settings;
+	std::vector<int> kept;  // per group, index of the identical old group whose state carries over, or -1
+	size_t changed;         // groups that are new or differ from the old table
+	size_t removed;         // old groups missing from the new table
+	uint64_t hash;
+	bool hashed;
+	bool cached;            // modegroup.cfg came from the cache
+	size_t main_groups;     // groups of modegroup.cfg alone
+	bool unchanged;         // reload found no changed file
+	bool failed;
+	SMCError error;         // why the load failed, turned into text by the main thread
+	SMCStates error_states;
+	std::string error_file; // "modegroup.cfg" or "modegroups/<name>"
+	std::vector<ConfigMessage> messages;
+	double ms;              // time spent on the loader thread
+	std::atomic<bool> done;
+};
+
+/**
+ * Files of a group pinned in memory by "sm modegroup prepare" until the group
+ * is switched to or the timeout runs out.
+ */
+struct PreparedGroup
+{
+	PreparedGroup();
+
+	std::string group;
+	std::shared_ptr<const ModeGroupTable> table; // the table the plan was compiled from
+	std::shared_ptr<const ModeGroupPlan> plan;
+	std::vector<std::unique_ptr<MappedFile>> files;
+	size_t bytes;
+	size_t locked_bytes;
+	std::chrono::steady_clock::time_point expires;
+};
+
+/**
+ * Steps of a switch, executed in this order.
+ */
+enum SwitchPhase
+{
+	SwitchPhase_None = 0,
+	SwitchPhase_Unload,      // plugins leaving with the old group
+	SwitchPhase_Prefetch,    // wait for the worker threads reading new plugins
+	SwitchPhase_Load,        // target plugins, in plan order
+	SwitchPhase_UnloadExtra, // the group's unload_plugins
+	SwitchPhase_Cvars,
+	SwitchPhase_Commands,
+	SwitchPhase_Done,
+};
+
+/**
+ * Progress of the switch that is currently running. m_LoadedPlugins is kept
+ * up to date after every step, so a switch can be abandoned at any point.
+ */
+struct SwitchState
+{
+	SwitchState();
+
+	SwitchPhase phase;
+	size_t index;
+	std::string group;
+	std::string oldGroup;
+	std::shared_ptr<const ModeGroupTable> table; // the table the switch started from, alive until it ends
+	std::shared_ptr<const ModeGroupPlan> plan;
+	std::vector<std::string> leaving;
+	const std::vector<std::string> *cvar_batches;
+	SwitchStats stats;
+	StopWatch started;
+	int request;             // switch request being served, 0 for map change switches
+	bool suspend;            // the old group has suspend_on_leave, pause leaving plugins
+	bool cvars_failed;       // use_sm_cvar is set but sm_cvar was missing, no cvar was set
+};
+
+/**
+ * A plugin paused instead of unloaded because the group it belonged to has
+ * suspend_on_leave. It is resumed by the next switch to a group that loads
+ * it, or unloaded once suspended plugins use more than suspend_memory_cap.
+ */
+struct SuspendedPlugin
+{
+	std::string group;       // group that was left
+	size_t bytes;            // memory of its runtime when it was paused
+	uint64_t stamp;          // suspend order, the lowest is unloaded first
+};
+
+/**
+ * What became of a switch request. Matches ModeGroupRequestStatus in
+ * modegroup.inc.
+ */
+enum SwitchRequestStatus
+{
+	SwitchRequest_Unknown = 0, // never issued, or too old to be remembered
+	SwitchRequest_Queued,      // waiting for the next frame or the debounce window
+	SwitchRequest_Running,
+	SwitchRequest_Done,
+	SwitchRequest_Superseded,  // replaced by a newer request before it finished
+	SwitchRequest_Failed,      // the group was gone or broken when the request ran, or its cvars could not be set
+};
+
+/**
+ * The newest switch request that has not started yet. Requests are only
+ * started from OnGameFrame, so a burst of them within the debounce window
+ * ends up as a single switch to the last group asked for.
+ */
+struct SwitchRequest
+{
+	SwitchRequest();
+
+	int id;                  // 0 when nothing is queued
+	std::string group;
+	std::chrono::steady_clock::time_point due;
+	StopWatch requested;     // the switch's wall time counts from here, kept when requests merge
+};
+
+/**
+ * A finished request, remembered for GetSwitchRequestStatus() and passed to
+ * OnModeGroupRequestDone at the end of the frame.
+ */
+struct SwitchRequestResult
+{
+	int id;
+	SwitchRequestStatus status;
+	std::string group;
+};
+
+class ModeGroupExtension : public SDKExtension, public IRootConsoleCommand, public IPluginsListener
 {
 public:
 	virtual bool SDK_OnLoad(char *error, size_t maxlen, bool late) override;
 	virtual void SDK_OnUnload() override;
 	virtual void SDK_OnAllLoaded() override;
 	virtual bool QueryRunning(char *error, size_t maxlen) override;
+	virtual void OnCoreMapEnd() override;
 
 public:
 	bool LoadConfig(char *error, size_t maxlen);
-	bool SwitchModeGroup(const char *groupName);
+	void StartConfigLoad(bool reload);
+	void RunConfigLoad(ConfigLoad *load);
+	bool ReadConfig(ConfigLoad &load);
+	bool MergeConfigFiles(ConfigLoad &load);
+	bool IsConfigLoadDone() const;
+	bool PublishConfig(char *error, size_t maxlen);
+	void WaitForConfigLoad();
+	void DiffConfig(ConfigLoad &load);
+	void ApplyReloadedConfig(ConfigLoad &load);
+	bool ParseConfig(const char *path, ModeGroupTable &groups,
+		ModeGroupSettings &settings, char *error, size_t maxlen);
+	bool ParseModeGroup(const ModeGroupTable &table, const ModeGroup &group, ModeGroupTable &body);
+	const ModeGroup *GetGroupBody(const ModeGroup &group, const ModeGroupTable *&table);
+	static bool HashFile(const char *path, uint64_t *hash);
+	static bool IsSameModeGroup(const ModeGroupTable &tableA, const ModeGroup &a,
+		const ModeGroupTable &tableB, const ModeGroup &b);
+	static bool IsUnchangedModeGroup(const ModeGroupTable &oldTable, const ModeGroup &old,
+		const ModeGroupTable &groups, const ModeGroup &group);
+	bool SwitchModeGroup(const char *groupName, bool immediate = false, int request = 0,
+		const StopWatch *requested = NULL);
+	int RequestSwitch(const char *groupName);
+	void RunQueuedSwitch();
+	void EndSwitchRequest(int id, SwitchRequestStatus status, const std::string &group);
+	SwitchRequestStatus GetSwitchRequestStatus(int id) const;
+	void NotifySwitchRequests();
+	bool SwitchModeGroupById(int id);
+	int FindModeGroupId(const char *groupName);
+	const char *GetModeGroupName(int id);
+	bool QueueModeGroupSwitch(const char *groupName);
+	bool PrepareModeGroup(const char *groupName);
+	void ReleasePreparedGroup();
+	bool PinFile(const char *path);
 	void UnloadCurrentModeGroup();
-	void LoadModeGroup(const ModeGroup &group);
+	void StartSwitch(const ModeGroup &group, bool forceDelta, bool immediate, int request,
+		const StopWatch *requested);
+	void BeginSwitch(const ModeGroup &group, bool forceDelta);
+	bool StepSwitch(bool block);
+	void RunSwitch(float budgetMs);
+	void FinishSwitch();
+	bool AddSwitchTime(const ModeGroupPlan &plan, SwitchPhase phase, double ms);
+	const SwitchStats *GetSwitchStats(size_t index) const;
+	void ShowSwitchStats(size_t index);
+	const char *GetConfigGroupName(const char *groupName);
+	void ShowHistograms(const char *groupName);
+	void ShowProfile(const char *groupName);
+	void SaveStats();
+	void OnGameFrame(bool simulating);
+	std::shared_ptr<const ModeGroupPlan> CompileModeGroup(const ModeGroupTable &table, const ModeGroup &group);
+	std::shared_ptr<const ModeGroupPlan> GetPlan(const ModeGroup &group);
+	void CollectGroupPlugins(const ModeGroupTable &table, const ModeGroup &group, std::vector<std::string> &plugins);
+	void SetPluginLoaded(const std::string &path, bool loaded);
+	bool SuspendPlugin(const std::string &path, const std::string &group);
+	bool ResumePlugin(const std::string &path);
+	bool ForgetSuspendedPlugin(const std::string &path);
+	size_t TrimSuspendedPlugins(size_t cap);
+	bool IsSmCvarAvailable();
 	void ScanDirectoryForPlugins(const char *path, std::vector<std::string> &plugins);
-	bool LoadPlugin(const char *path);
-	void UnloadPlugin(const char *path);
+	bool LoadPlugin(const char *path, const std::string &group);
+	void UnloadPlugin(const char *path, const std::string &group);
+	void UnloadPlugins(const std::vector<std::string> &paths, const std::string &group);
+	IPlugin *FindPluginByFile(const std::string &path);
 	void ReloadConfig();
 	void ListModeGroups();
 	const char *GetCurrentModeGroupName();
+	int GetCurrentModeGroupId()
+	{
+		return m_CurrentModeGroupId;
+	}
 	void CurrentModeGroup();
 
 public:
 	void OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args) override;
 
+public: // IPluginsListener
+	void OnPluginCreated(IPlugin *plugin) override;
+	void OnPluginLoaded(IPlugin *plugin) override;
+	void OnPluginDestroyed(IPlugin *plugin) override;
+
 private:
-	std::map<std::string, ModeGroup> m_ModeGroups;
+	std::shared_ptr<const ModeGroupTable> m_ModeGroups; // the live table, replaced whole by PublishConfig
+	std::vector<ModeGroupState> m_GroupStates; // by group index of m_ModeGroups
+	GroupIdRegistry m_GroupIds;    // only used by the loader thread
+	ModeGroupSettings m_Settings;
+	uint64_t m_ConfigHash;         // of modegroup.cfg alone
+	ConfigDirectory m_ConfigFiles; // configs/modegroups/*.cfg, merged after modegroup.cfg
+	std::unique_ptr<ConfigLoad> m_Load; // running on m_LoadThread
+	std::thread m_LoadThread;
+	bool m_ReloadQueued;           // reload again once m_Load is published
+	SwitchState m_Switch;
+	SwitchRequest m_QueuedSwitch;  // started by OnGameFrame once due
+	int m_NextRequestId;
+	std::vector<SwitchRequestResult> m_RequestResults; // most recent last
+	std::vector<SwitchRequestResult> m_RequestNotices; // not passed to the forward yet
+	PreparedGroup m_Prepared;
 	std::string m_CurrentModeGroup;
-	std::vector<std::string> m_LoadedPlugins;
+	int m_CurrentModeGroupId;
+	std::string m_PendingModeGroup; // switched to at the next map change
+	std::vector<std::string> m_LoadedPlugins; // sorted
+	std::unordered_map<std::string, SuspendedPlugin> m_Suspended; // paused, not in m_LoadedPlugins
+	std::map<uint64_t, std::string> m_SuspendOrder; // m_Suspended by stamp, least recently used first
+	size_t m_SuspendedBytes;
+	uint64_t m_SuspendStamp;
+	std::unordered_map<std::string, IPlugin *> m_PluginsByFile;
+	PluginDirectoryIndex m_PluginDirs;
+	PluginPrefetcher m_Prefetch;
+	SwitchStatsHistory m_SwitchStats;
+	SwitchHistograms m_Histograms;
+	PluginProfiler m_Profiler;
 	IForward *m_pModeGroupChangedForward;
+	IForward *m_pRequestDoneForward;
 };
 
 extern ModeGroupExtension g_ModeGroupExtension;
@@ -0,0 +1,428 @@
+#include "grouptable.h"
+#include <cctype>
+
+// 大部分配置的字符串一块就放得下
+#define STRING_CHUNK_MIN	(16 * 1024)
+#define STRING_CHUNK_MAX	(1024 * 1024)
+
+StringPool::StringPool()
+{
+	Clear();
+}
+
+void StringPool::Clear()
+{
+	m_Chunks.clear();
+	m_ChunkUsed = 0;
+	m_ChunkSize = 0;
+	m_ChunkBytes = 0;
+	m_Entries.clear();
+	m_Slots.assign(64, 0);
+
+	Intern("", 0);
+}
+
+uint32_t StringPool::Hash(const char *str, size_t length)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261U;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ (unsigned char)str[i]) * 16777619U;
+	}
+	return hash;
+}
+
+size_t StringPool::FindSlot(const char *str, size_t length, uint32_t hash) const
+{
+	size_t mask = m_Slots.size() - 1;
+	for (size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+	{
+		uint32_t value = m_Slots[slot];
+		if (value == 0)
+		{
+			return slot;
+		}
+
+		const Entry &entry = m_Entries[value - 1];
+		if (entry.hash == hash && entry.length == length && memcmp(entry.str, str, length) == 0)
+		{
+			return slot;
+		}
+	}
+}
+
+char *StringPool::Allocate(size_t size)
+{
+	if (m_Chunks.empty() || m_ChunkUsed + size > m_ChunkSize)
+	{
+		// 每块比上一块大一倍, 大配置也只有几块
+		size_t chunkSize = m_ChunkSize ? m_ChunkSize * 2 : STRING_CHUNK_MIN;
+		if (chunkSize > STRING_CHUNK_MAX)
+		{
+			chunkSize = STRING_CHUNK_MAX;
+		}
+		if (chunkSize < size)
+		{
+			chunkSize = size;
+		}
+
+		m_Chunks.push_back(std::unique_ptr<char[]>(new char[chunkSize]));
+		m_ChunkSize = chunkSize;
+		m_ChunkUsed = 0;
+		m_ChunkBytes += chunkSize;
+	}
+
+	char *p = m_Chunks.back().get() + m_ChunkUsed;
+	m_ChunkUsed += size;
+	return p;
+}
+
+void StringPool::Grow()
+{
+	Rehash(m_Slots.size() * 2);
+}
+
+void StringPool::Rehash(size_t slotCount)
+{
+	std::vector<uint32_t> slots(slotCount, 0);
+	size_t mask = slots.size() - 1;
+	for (size_t i = 0; i < m_Entries.size(); i++)
+	{
+		size_t slot = m_Entries[i].hash & mask;
+		while (slots[slot] != 0)
+		{
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = (uint32_t)(i + 1);
+	}
+	m_Slots.swap(slots);
+}
+
+StringId StringPool::Intern(const char *str, size_t length)
+{
+	uint32_t hash = Hash(str, length);
+	size_t slot = FindSlot(str, length, hash);
+	if (m_Slots[slot] != 0)
+	{
+		return m_Slots[slot] - 1;
+	}
+
+	char *copy = Allocate(length + 1);
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+
+	Entry entry;
+	entry.str = copy;
+	entry.length = (uint32_t)length;
+	entry.hash = hash;
+	m_Entries.push_back(entry);
+
+	StringId id = (StringId)(m_Entries.size() - 1);
+	m_Slots[slot] = id + 1;
+
+	// 负载超过一半时扩容, 探测链保持很短
+	if (m_Entries.size() * 2 > m_Slots.size())
+	{
+		Grow();
+	}
+
+	return id;
+}
+
+StringId StringPool::AddExternal(const char *str, uint32_t length, uint32_t hash)
+{
+	Entry entry;
+	entry.str = str;
+	entry.length = length;
+	entry.hash = hash;
+	m_Entries.push_back(entry);
+
+	// 调用方保证不重复, 直接找空位
+	StringId id = (StringId)(m_Entries.size() - 1);
+	size_t mask = m_Slots.size() - 1;
+	size_t slot = hash & mask;
+	while (m_Slots[slot] != 0)
+	{
+		slot = (slot + 1) & mask;
+	}
+	m_Slots[slot] = id + 1;
+
+	if (m_Entries.size() * 2 > m_Slots.size())
+	{
+		Grow();
+	}
+
+	return id;
+}
+
+void StringPool::Reserve(size_t count)
+{
+	m_Entries.reserve(count);
+
+	size_t slotCount = m_Slots.size();
+	while (count * 2 > slotCount)
+	{
+		slotCount *= 2;
+	}
+	if (slotCount != m_Slots.size())
+	{
+		Rehash(slotCount);
+	}
+}
+
+StringId StringPool::Find(const char *str) const
+{
+	size_t length = strlen(str);
+	size_t slot = FindSlot(str, length, Hash(str, length));
+	return m_Slots[slot] != 0 ? m_Slots[slot] - 1 : INVALID_STRING_ID;
+}
+
+size_t StringPool::GetMemoryUsage() const
+{
+	return m_ChunkBytes + m_Entries.capacity() * sizeof(Entry) + m_Slots.capacity() * sizeof(uint32_t);
+}
+
+ModeGroup::ModeGroup()
+	: id(INVALID_GROUP_ID), name(0), plugin_directory(0), use_sm_cvar(true), suspend_on_leave(false), parsed(true),
+	source_offset(0), source_length(0), source_line(0), source_col(0), source_file(0)
+{
+}
+
+static uint32_t HashNoCase(const char *str)
+{
+	// FNV-1a over the lower case bytes
+	uint32_t hash = 2166136261U;
+	for (; *str; str++)
+	{
+		hash = (hash ^ (unsigned char)tolower((unsigned char)*str)) * 16777619U;
+	}
+	return hash;
+}
+
+static bool EqualsNoCase(const char *a, const char *b)
+{
+	for (; *a && *b; a++, b++)
+	{
+		if (tolower((unsigned char)*a) != tolower((unsigned char)*b))
+		{
+			return false;
+		}
+	}
+	return *a == *b;
+}
+
+ModeGroupTable::ModeGroupTable()
+{
+	Clear();
+}
+
+void ModeGroupTable::Clear()
+{
+	m_Strings.Clear();
+	m_Ids.clear();
+	m_IdView = NULL;
+	m_IdViewCount = 0;
+	m_Mapping.reset();
+	m_Groups.clear();
+	m_NameSlots.assign(16, 0);
+	m_GroupById.clear();
+	m_Source.clear();
+}
+
+size_t ModeGroupTable::FindSlot(const char *name, uint32_t hash) const
+{
+	size_t mask = m_NameSlots.size() - 1;
+	for (size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+	{
+		uint32_t value = m_NameSlots[slot];
+		if (value == 0 || EqualsNoCase(m_Strings.Get(m_Groups[value - 1].name), name))
+		{
+			return slot;
+		}
+	}
+}
+
+void ModeGroupTable::GrowNameIndex()
+{
+	std::vector<uint32_t> slots(m_NameSlots.size() * 2, 0);
+	size_t mask = slots.size() - 1;
+	for (size_t i = 0; i < m_Groups.size(); i++)
+	{
+		size_t slot = HashNoCase(m_Strings.Get(m_Groups[i].name)) & mask;
+		while (slots[slot] != 0)
+		{
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = (uint32_t)(i + 1);
+	}
+	m_NameSlots.swap(slots);
+}
+
+ModeGroup *ModeGroupTable::Find(const char *name)
+{
+	uint32_t value = m_NameSlots[FindSlot(name, HashNoCase(name))];
+	return value != 0 ? &m_Groups[value - 1] : NULL;
+}
+
+const ModeGroup *ModeGroupTable::Find(const char *name) const
+{
+	return const_cast<ModeGroupTable *>(this)->Find(name);
+}
+
+ModeGroup *ModeGroupTable::FindById(int id)
+{
+	if (id < 0 || (size_t)id >= m_GroupById.size() || m_GroupById[id] == 0)
+	{
+		return NULL;
+	}
+	return &m_Groups[m_GroupById[id] - 1];
+}
+
+const ModeGroup *ModeGroupTable::FindById(int id) const
+{
+	return const_cast<ModeGroupTable *>(this)->FindById(id);
+}
+
+ModeGroup &ModeGroupTable::Add(const ModeGroup &group)
+{
+	// 重名的分组以后出现的为准, 和以前的 std::map 一样
+	const char *name = m_Strings.Get(group.name);
+	size_t slot = FindSlot(name, HashNoCase(name));
+	if (m_NameSlots[slot] != 0)
+	{
+		ModeGroup &existing = m_Groups[m_NameSlots[slot] - 1];
+		existing = group;
+		return existing;
+	}
+
+	m_Groups.push_back(group);
+	m_NameSlots[slot] = (uint32_t)m_Groups.size();
+
+	if (m_Groups.size() * 2 > m_NameSlots.size())
+	{
+		GrowNameIndex();
+	}
+
+	return m_Groups.back();
+}
+
+StringId ModeGroupTable::ImportString(const ModeGroupTable &other, StringId id)
+{
+	return m_Strings.Intern(other.m_Strings.Get(id), other.m_Strings.GetLength(id));
+}
+
+void ModeGroupTable::CopyIdView()
+{
+	// 从缓存读出的表要合并其他文件时才复制 ID 数组, 字符串仍然指向映射
+	if (m_IdView)
+	{
+		m_Ids.assign(m_IdView, m_IdView + m_IdViewCount);
+		m_IdView = NULL;
+		m_IdViewCount = 0;
+	}
+}
+
+IdSpan ModeGroupTable::ImportIds(const ModeGroupTable &other, IdSpan span)
+{
+	CopyIdView();
+
+	IdSpan copy;
+	copy.offset = (uint32_t)m_Ids.size();
+	copy.count = span.count;
+
+	const StringId *ids = other.GetIds(span);
+	for (uint32_t i = 0; i < span.count; i++)
+	{
+		m_Ids.push_back(ImportString(other, ids[i]));
+	}
+	return copy;
+}
+
+ModeGroup &ModeGroupTable::Import(const ModeGroupTable &other, const ModeGroup &group)
+{
+	// 两个表的字符串 ID 互不相干, 逐个重新放进本表的字符串池
+	ModeGroup copy;
+	copy.name = ImportString(other, group.name);
+	copy.plugin_directory = ImportString(other, group.plugin_directory);
+	copy.load_plugins = ImportIds(other, group.load_plugins);
+	copy.unload_plugins = ImportIds(other, group.unload_plugins);
+	copy.cvars = ImportIds(other, group.cvars);
+	copy.commands = ImportIds(other, group.commands);
+	copy.use_sm_cvar = group.use_sm_cvar;
+	copy.suspend_on_leave = group.suspend_on_leave;
+	copy.parsed = group.parsed;
+
+	if (group.source_length != 0)
+	{
+		copy.source_offset = (uint32_t)m_Source.size();
+		copy.source_length = group.source_length;
+		copy.source_line = group.source_line;
+		copy.source_col = group.source_col;
+		copy.source_file = ImportString(other, group.source_file);
+		m_Source.append(other.GetSource(group.source_offset), group.source_length);
+	}
+
+	return Add(copy);
+}
+
+void ModeGroupTable::SetId(size_t index, int id)
+{
+	if ((size_t)id >= m_GroupById.size())
+	{
+		m_GroupById.resize(id + 1, 0);
+	}
+
+	m_Groups[index].id = id;
+	m_GroupById[id] = (uint32_t)(index + 1);
+}
+
+IdSpan ModeGroupTable::AddIds(const StringId *ids, size_t count)
+{
+	CopyIdView();
+
+	IdSpan span;
+	span.offset = (uint32_t)m_Ids.size();
+	span.count = (uint32_t)count;
+	m_Ids.insert(m_Ids.end(), ids, ids + count);
+	return span;
+}
+
+size_t ModeGroupTable::GetMemoryUsage() const
+{
+	return m_Strings.GetMemoryUsage() + m_Ids.capacity() * sizeof(StringId)
+		+ m_Groups.capacity() * sizeof(ModeGroup)
+		+ (m_NameSlots.capacity() + m_GroupById.capacity()) * sizeof(uint32_t)
+		+ m_Source.capacity();
+}
+
+GroupIdRegistry::GroupIdRegistry() : m_NextId(0)
+{
+}
+
+int GroupIdRegistry::GetId(const char *name)
+{
+	std::string key = name;
+	for (size_t i = 0; i < key.size(); i++)
+	{
+		key[i] = (char)tolower((unsigned char)key[i]);
+	}
+
+	std::unordered_map<std::string, int>::iterator it = m_Ids.find(key);
+	if (it != m_Ids.end())
+	{
+		return it->second;
+	}
+
+	int id = m_NextId++;
+	m_Ids[key] = id;
+	return id;
+}
+
+void GroupIdRegistry::Assign(ModeGroupTable &table)
+{
+	for (size_t i = 0; i < table.Count(); i++)
+	{
+		table.SetId(i, GetId(table.GetString(table.Get(i).name)));
+	}
+}
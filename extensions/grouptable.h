@@ -0,0 +1,285 @@
+#ifndef _INCLUDE_MODEGROUP_GROUPTABLE_H_
+#define _INCLUDE_MODEGROUP_GROUPTABLE_H_
+
+/**
+ * @file grouptable.h
+ * @brief Interned, arena-backed storage of the parsed mode groups.
+ */
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <cstring>
+#include <stdint.h>
+
+/**
+ * Index of a string in a StringPool. 0 is always the empty string.
+ */
+typedef uint32_t StringId;
+
+#define INVALID_STRING_ID	0xFFFFFFFF
+#define INVALID_GROUP_ID	-1
+
+class MappedFile;
+
+/**
+ * Every distinct string is stored once, NUL terminated, in large chunks that
+ * never move, so the pointers returned by Get() stay valid until Clear().
+ * The lookup table is open addressed and holds no pointers of its own.
+ * Strings added with AddExternal() are not copied into the chunks.
+ */
+class StringPool
+{
+public:
+	StringPool();
+
+	StringId Intern(const char *str, size_t length);
+	StringId Intern(const char *str)
+	{
+		return Intern(str, strlen(str));
+	}
+
+	/**
+	 * Adds a NUL terminated string stored elsewhere, which must stay valid
+	 * as long as the pool uses it. The string must not be in the pool yet
+	 * and hash must be what GetHash() would return for it.
+	 */
+	StringId AddExternal(const char *str, uint32_t length, uint32_t hash);
+
+	/**
+	 * Makes room for count strings in total.
+	 */
+	void Reserve(size_t count);
+
+	/**
+	 * Returns the ID of an already interned string or INVALID_STRING_ID.
+	 */
+	StringId Find(const char *str) const;
+
+	const char *Get(StringId id) const
+	{
+		return m_Entries[id].str;
+	}
+	size_t GetLength(StringId id) const
+	{
+		return m_Entries[id].length;
+	}
+	uint32_t GetHash(StringId id) const
+	{
+		return m_Entries[id].hash;
+	}
+	size_t Count() const
+	{
+		return m_Entries.size();
+	}
+
+	/**
+	 * Bytes held by the chunks and tables.
+	 */
+	size_t GetMemoryUsage() const;
+
+	void Clear();
+
+private:
+	struct Entry
+	{
+		const char *str;
+		uint32_t length;
+		uint32_t hash;
+	};
+
+	static uint32_t Hash(const char *str, size_t length);
+	size_t FindSlot(const char *str, size_t length, uint32_t hash) const;
+	char *Allocate(size_t size);
+	void Grow();
+	void Rehash(size_t slotCount);
+
+private:
+	std::vector<std::unique_ptr<char[]>> m_Chunks;
+	size_t m_ChunkUsed;
+	size_t m_ChunkSize;
+	size_t m_ChunkBytes;
+	std::vector<Entry> m_Entries;
+	std::vector<uint32_t> m_Slots; // ID + 1, 0 for an empty slot
+};
+
+/**
+ * Consecutive IDs in the ID arena of a ModeGroupTable.
+ */
+struct IdSpan
+{
+	IdSpan() : offset(0), count(0)
+	{
+	}
+
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct ModeGroup
+{
+	ModeGroup();
+
+	int id; // from GroupIdRegistry, INVALID_GROUP_ID until assigned
+	StringId name;
+	StringId plugin_directory;
+	IdSpan load_plugins;
+	IdSpan unload_plugins;
+	IdSpan cvars;    // name, value pairs in config order, duplicates kept
+	IdSpan commands; // name, value pairs in config order, duplicates kept
+	bool use_sm_cvar;
+	bool suspend_on_leave; // pause the group's plugins when leaving it instead of unloading them
+
+	// lazy_parse: only the name is known until the group is first used, the
+	// body is parsed from this byte range of the table's source text
+	bool parsed;
+	uint32_t source_offset;
+	uint32_t source_length;
+	uint32_t source_line;
+	uint32_t source_col;  // column of the range's first character in source_line
+	StringId source_file; // config file the range came from, for error messages
+};
+
+/**
+ * All mode groups of a config. Strings live in one StringPool, every list of
+ * a group is a span of a single ID arena, so building the table makes a few
+ * large allocations and dropping it releases them at once. Group names are
+ * looked up case-insensitively through a hash index.
+ *
+ * A table is built by one thread and then published as a
+ * std::shared_ptr<const ModeGroupTable>; after that nothing changes it, so
+ * any thread holding a reference may read it.
+ *
+ * A table read from the config cache uses the strings and the ID arena in
+ * place in the mapped file and keeps the mapping open. Adding IDs to such a
+ * table copies the arena out first.
+ */
+class ModeGroupTable
+{
+public:
+	ModeGroupTable();
+
+	void Clear();
+
+	size_t Count() const
+	{
+		return m_Groups.size();
+	}
+	ModeGroup &Get(size_t index)
+	{
+		return m_Groups[index];
+	}
+	const ModeGroup &Get(size_t index) const
+	{
+		return m_Groups[index];
+	}
+
+	ModeGroup *Find(const char *name);
+	const ModeGroup *Find(const char *name) const;
+	ModeGroup *FindById(int id);
+	const ModeGroup *FindById(int id) const;
+
+	/**
+	 * Adds a group whose name and lists were built with Intern() and
+	 * AddIds(). A group with the same name, ignoring case, is replaced.
+	 */
+	ModeGroup &Add(const ModeGroup &group);
+
+	/**
+	 * Adds a copy of a group of another table, with its strings interned in
+	 * this one and the source text of an unparsed group appended to this
+	 * table's source. The ID is not copied.
+	 */
+	ModeGroup &Import(const ModeGroupTable &other, const ModeGroup &group);
+
+	size_t IndexOf(const ModeGroup &group) const
+	{
+		return &group - m_Groups.data();
+	}
+
+	void SetId(size_t index, int id);
+
+	StringId Intern(const char *str)
+	{
+		return m_Strings.Intern(str);
+	}
+	StringId Intern(const char *str, size_t length)
+	{
+		return m_Strings.Intern(str, length);
+	}
+	const char *GetString(StringId id) const
+	{
+		return m_Strings.Get(id);
+	}
+
+	IdSpan AddIds(const StringId *ids, size_t count);
+	const StringId *GetIds(IdSpan span) const
+	{
+		return (m_IdView ? m_IdView : m_Ids.data()) + span.offset;
+	}
+
+	/**
+	 * Keeps the config text that unparsed groups point into. The string is
+	 * swapped in, not copied.
+	 */
+	void SetSource(std::string &source)
+	{
+		m_Source.swap(source);
+	}
+	const char *GetSource(uint32_t offset) const
+	{
+		return m_Source.data() + offset;
+	}
+
+	/**
+	 * Bytes held by the strings, the ID arena, the group records and the
+	 * source text. A mapped cache file is not counted.
+	 */
+	size_t GetMemoryUsage() const;
+
+private:
+	size_t FindSlot(const char *name, uint32_t hash) const;
+	void GrowNameIndex();
+	StringId ImportString(const ModeGroupTable &other, StringId id);
+	IdSpan ImportIds(const ModeGroupTable &other, IdSpan span);
+	void CopyIdView();
+
+private:
+	friend class ConfigCache;
+
+	StringPool m_Strings;
+	std::vector<StringId> m_Ids;
+	const StringId *m_IdView; // the ID arena in m_Mapping, used instead of m_Ids
+	size_t m_IdViewCount;
+	std::shared_ptr<const MappedFile> m_Mapping; // the cache file read in place, if any
+	std::vector<ModeGroup> m_Groups;
+	std::vector<uint32_t> m_NameSlots; // group index + 1, 0 for an empty slot
+	std::vector<uint32_t> m_GroupById; // by group ID, group index + 1
+	std::string m_Source;
+};
+
+/**
+ * Hands out integer IDs for group names, ignoring case. An ID is never
+ * renumbered or reused while the extension is loaded, so plugins can keep
+ * one across config reloads; a group that is removed and added back gets
+ * its old ID again.
+ */
+class GroupIdRegistry
+{
+public:
+	GroupIdRegistry();
+
+	int GetId(const char *name);
+
+	/**
+	 * Gives every group of the table its ID.
+	 */
+	void Assign(ModeGroupTable &table);
+
+private:
+	std::unordered_map<std::string, int> m_Ids; // by lower case name
+	int m_NextId;
+};
+
+#endif // _INCLUDE_MODEGROUP_GROUPTABLE_H_
@@ -0,0 +1,198 @@
+#include "mappedfile.h"
+
+#if defined PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile() : m_Base(NULL), m_Size(0), m_Open(false), m_Locked(false)
+#if defined PLATFORM_WINDOWS
+	, m_File(INVALID_HANDLE_VALUE), m_Map(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#if defined PLATFORM_WINDOWS
+
+bool MappedFile::Open(const char *path)
+{
+	Close();
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	m_File = file;
+	m_Size = (size_t)size.QuadPart;
+	m_Open = true;
+
+	// 空文件不能映射
+	if (m_Size == 0)
+	{
+		return true;
+	}
+
+	m_Map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_Map)
+	{
+		m_Base = MapViewOfFile((HANDLE)m_Map, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (!m_Base)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Base)
+	{
+		if (m_Locked)
+		{
+			VirtualUnlock(m_Base, m_Size);
+		}
+		UnmapViewOfFile(m_Base);
+	}
+	if (m_Map)
+	{
+		CloseHandle((HANDLE)m_Map);
+	}
+	if (m_File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle((HANDLE)m_File);
+	}
+
+	m_Base = NULL;
+	m_Map = NULL;
+	m_File = INVALID_HANDLE_VALUE;
+	m_Size = 0;
+	m_Open = false;
+	m_Locked = false;
+}
+
+bool MappedFile::Lock()
+{
+	if (m_Locked || !m_Base)
+	{
+		return m_Locked;
+	}
+
+	m_Locked = VirtualLock(m_Base, m_Size) != FALSE;
+	return m_Locked;
+}
+
+#else
+
+bool MappedFile::Open(const char *path)
+{
+	Close();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	m_Size = (size_t)st.st_size;
+	m_Open = true;
+
+	// 空文件不能映射
+	if (m_Size == 0)
+	{
+		close(fd);
+		return true;
+	}
+
+	void *base = mmap(NULL, m_Size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	m_Base = base;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Base)
+	{
+		if (m_Locked)
+		{
+			munlock(m_Base, m_Size);
+		}
+		munmap(m_Base, m_Size);
+	}
+
+	m_Base = NULL;
+	m_Size = 0;
+	m_Open = false;
+	m_Locked = false;
+}
+
+bool MappedFile::Lock()
+{
+	if (m_Locked || !m_Base)
+	{
+		return m_Locked;
+	}
+
+	m_Locked = mlock(m_Base, m_Size) == 0;
+	return m_Locked;
+}
+
+#endif
+
+void MappedFile::Prefault()
+{
+	if (!m_Base)
+	{
+		return;
+	}
+
+#if !defined PLATFORM_WINDOWS
+	madvise(m_Base, m_Size, MADV_WILLNEED);
+#endif
+
+	// 逐页读一个字节, 缺页在这里发生而不是在切换时
+	const volatile char *p = (const volatile char *)m_Base;
+	char sum = 0;
+	for (size_t i = 0; i < m_Size; i += 4096)
+	{
+		sum += p[i];
+	}
+	sum += p[m_Size - 1];
+	(void)sum;
+}
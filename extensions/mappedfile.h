@@ -0,0 +1,63 @@
+#ifndef _INCLUDE_MODEGROUP_MAPPEDFILE_H_
+#define _INCLUDE_MODEGROUP_MAPPEDFILE_H_
+
+/**
+ * @file mappedfile.h
+ * @brief Read-only memory mapping of a whole file.
+ */
+
+#include "smsdk_ext.h"
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator =(const MappedFile &) = delete;
+
+	bool Open(const char *path);
+	void Close();
+
+	/**
+	 * Asks the OS to read the whole mapping ahead and touches every page so
+	 * later accesses do not fault to disk.
+	 */
+	void Prefault();
+
+	/**
+	 * Locks the mapping in memory. Fails when the process is over its
+	 * locked memory limit.
+	 */
+	bool Lock();
+
+	bool IsOpen() const
+	{
+		return m_Open;
+	}
+	const char *GetData() const
+	{
+		return (const char *)m_Base;
+	}
+	size_t GetSize() const
+	{
+		return m_Size;
+	}
+	bool IsLocked() const
+	{
+		return m_Locked;
+	}
+
+private:
+	void *m_Base;
+	size_t m_Size;
+	bool m_Open;
+	bool m_Locked;
+#if defined PLATFORM_WINDOWS
+	void *m_File;
+	void *m_Map;
+#endif
+};
+
+#endif // _INCLUDE_MODEGROUP_MAPPEDFILE_H_
@@ -0,0 +1,276 @@
+#include "pluginprofile.h"
+#include "cachestream.h"
+#include "configcache.h"
+#include "mappedfile.h"
+#include <algorithm>
+
+#if defined PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#define PLUGIN_PROFILE_MAGIC	0x4650474D // "MGPF"
+#define PLUGIN_PROFILE_VERSION	1
+
+/**
+ * Layout of data/modegroup.profile after the header:
+ *   u32 plugin count
+ *   per plugin: path, load totals, unload totals, u64 memory, group list
+ *   totals: u64 count, wall_us, cpu_us, max_wall_us, last_wall_us
+ */
+struct PluginProfileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t payload_size;
+	uint64_t payload_hash;
+};
+
+static uint64_t ToMicroseconds(double ms)
+{
+	return ms > 0.0 ? (uint64_t)(ms * 1000.0 + 0.5) : 0;
+}
+
+PluginCost::PluginCost() : wall_ms(0.0), cpu_ms(0.0), mem_bytes(0)
+{
+}
+
+CostMeter::CostMeter() : m_CpuStart(GetThreadCpuMs())
+{
+}
+
+void CostMeter::Stop(PluginCost &cost) const
+{
+	cost.wall_ms = m_Wall.ElapsedMs();
+	cost.cpu_ms = GetThreadCpuMs() - m_CpuStart;
+}
+
+double CostMeter::GetThreadCpuMs()
+{
+#if defined PLATFORM_WINDOWS
+	FILETIME creation, exited, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exited, &kernel, &user))
+	{
+		return 0.0;
+	}
+
+	// FILETIME 的单位是 100 纳秒
+	uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (k + u) / 10000.0;
+#elif defined CLOCK_THREAD_CPUTIME_ID
+	// getrusage() 在 Linux 上按时钟中断采样, 毫秒级的加载量不准
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+	{
+		return 0.0;
+	}
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0.0;
+	}
+
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0
+		+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+#endif
+}
+
+PluginCostTotals::PluginCostTotals() : count(0), wall_us(0), cpu_us(0), max_wall_us(0), last_wall_us(0)
+{
+}
+
+void PluginCostTotals::Add(const PluginCost &cost)
+{
+	uint64_t wall = ToMicroseconds(cost.wall_ms);
+	count++;
+	wall_us += wall;
+	cpu_us += ToMicroseconds(cost.cpu_ms);
+	last_wall_us = wall;
+	if (wall > max_wall_us)
+	{
+		max_wall_us = wall;
+	}
+}
+
+PluginProfile::PluginProfile() : mem_bytes(0)
+{
+}
+
+static void WriteTotals(CacheWriter &w, const PluginCostTotals &totals)
+{
+	w.U64(totals.count);
+	w.U64(totals.wall_us);
+	w.U64(totals.cpu_us);
+	w.U64(totals.max_wall_us);
+	w.U64(totals.last_wall_us);
+}
+
+static void ReadTotals(CacheReader &r, PluginCostTotals &totals)
+{
+	totals.count = r.U64();
+	totals.wall_us = r.U64();
+	totals.cpu_us = r.U64();
+	totals.max_wall_us = r.U64();
+	totals.last_wall_us = r.U64();
+}
+
+PluginProfiler::PluginProfiler() : m_Dirty(false)
+{
+}
+
+void PluginProfiler::RecordLoad(const std::string &plugin, const std::string &group, const PluginCost &cost)
+{
+	PluginProfile &profile = m_Plugins[plugin];
+	profile.load.Add(cost);
+	profile.mem_bytes = cost.mem_bytes;
+	if (!group.empty())
+	{
+		profile.groups.insert(group);
+	}
+	m_Dirty = true;
+}
+
+void PluginProfiler::RecordUnload(const std::string &plugin, const std::string &group, const PluginCost &cost)
+{
+	PluginProfile &profile = m_Plugins[plugin];
+	profile.unload.Add(cost);
+	if (!group.empty())
+	{
+		profile.groups.insert(group);
+	}
+	m_Dirty = true;
+}
+
+static bool CompareCost(const std::pair<std::string, const PluginProfile *> &a,
+	const std::pair<std::string, const PluginProfile *> &b)
+{
+	double costA = a.second->GetCostMs();
+	double costB = b.second->GetCostMs();
+	if (costA != costB)
+	{
+		return costA > costB;
+	}
+	return a.first < b.first;
+}
+
+static bool HasGroup(const PluginProfile &profile, const char *group)
+{
+	// 分组名不区分大小写, 配置改过写法时以前的记录也算
+	for (std::set<std::string>::const_iterator it = profile.groups.begin(); it != profile.groups.end(); ++it)
+	{
+		if (strcasecmp(it->c_str(), group) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void PluginProfiler::GetRanking(const char *group, std::vector<std::pair<std::string, const PluginProfile *>> &ranking) const
+{
+	ranking.clear();
+	for (std::map<std::string, PluginProfile>::const_iterator it = m_Plugins.begin(); it != m_Plugins.end(); ++it)
+	{
+		if (group && !HasGroup(it->second, group))
+		{
+			continue;
+		}
+		ranking.push_back(std::make_pair(it->first, &it->second));
+	}
+
+	std::sort(ranking.begin(), ranking.end(), CompareCost);
+}
+
+bool PluginProfiler::Load(const char *path)
+{
+	m_Plugins.clear();
+	m_Dirty = false;
+
+	MappedFile file;
+	if (!file.Open(path) || file.GetSize() < sizeof(PluginProfileHeader))
+	{
+		return false;
+	}
+
+	PluginProfileHeader header;
+	memcpy(&header, file.GetData(), sizeof(header));
+
+	const char *payload = file.GetData() + sizeof(header);
+	size_t payloadSize = file.GetSize() - sizeof(header);
+
+	if (header.magic != PLUGIN_PROFILE_MAGIC
+		|| header.version != PLUGIN_PROFILE_VERSION
+		|| header.payload_size != payloadSize
+		|| header.payload_hash != ConfigCache::Hash(payload, payloadSize))
+	{
+		return false;
+	}
+
+	CacheReader r(payload, payloadSize);
+	uint32_t count = r.U32();
+	std::string name;
+	std::vector<std::string> groups;
+	for (uint32_t i = 0; i < count && !r.Failed(); i++)
+	{
+		r.Str(name);
+		PluginProfile &profile = m_Plugins[name];
+		ReadTotals(r, profile.load);
+		ReadTotals(r, profile.unload);
+		profile.mem_bytes = (int64_t)r.U64();
+
+		groups.clear();
+		r.List(groups);
+		profile.groups.insert(groups.begin(), groups.end());
+	}
+
+	if (r.Failed() || !r.AtEnd())
+	{
+		m_Plugins.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool PluginProfiler::Save(const char *path)
+{
+	if (!m_Dirty)
+	{
+		return true;
+	}
+
+	CacheWriter w;
+	std::vector<std::string> groups;
+	w.U32((uint32_t)m_Plugins.size());
+	for (std::map<std::string, PluginProfile>::const_iterator it = m_Plugins.begin(); it != m_Plugins.end(); ++it)
+	{
+		w.Str(it->first);
+		WriteTotals(w, it->second.load);
+		WriteTotals(w, it->second.unload);
+		w.U64((uint64_t)it->second.mem_bytes);
+
+		groups.assign(it->second.groups.begin(), it->second.groups.end());
+		w.List(groups);
+	}
+
+	PluginProfileHeader header;
+	header.magic = PLUGIN_PROFILE_MAGIC;
+	header.version = PLUGIN_PROFILE_VERSION;
+	header.payload_size = w.Data().size();
+	header.payload_hash = ConfigCache::Hash(w.Data().data(), w.Data().size());
+
+	if (!WriteCacheFile(path, &header, sizeof(header), w.Data()))
+	{
+		return false;
+	}
+
+	m_Dirty = false;
+	return true;
+}
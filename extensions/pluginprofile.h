@@ -0,0 +1,135 @@
+#ifndef _INCLUDE_MODEGROUP_PLUGINPROFILE_H_
+#define _INCLUDE_MODEGROUP_PLUGINPROFILE_H_
+
+/**
+ * @file pluginprofile.h
+ * @brief Per-plugin load and unload costs, kept across server restarts.
+ */
+
+#include "smsdk_ext.h"
+#include "switchstats.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+/**
+ * Cost of a single plugin load or unload.
+ */
+struct PluginCost
+{
+	PluginCost();
+
+	double wall_ms;
+	double cpu_ms;     // CPU time of the calling thread
+	int64_t mem_bytes; // change of the plugin runtime's memory usage
+};
+
+/**
+ * Measures the wall and CPU time of a plugin load or unload. CPU time is
+ * taken for the calling thread, so the prefetch worker threads do not show up
+ * in it; platforms without a thread CPU clock fall back to getrusage() for
+ * the whole process.
+ */
+class CostMeter
+{
+public:
+	CostMeter();
+
+	void Stop(PluginCost &cost) const;
+
+	static double GetThreadCpuMs();
+
+private:
+	StopWatch m_Wall;
+	double m_CpuStart;
+};
+
+/**
+ * Running totals of one kind of operation on a plugin. Times are kept in
+ * microseconds so the totals survive the round trip through the file.
+ */
+struct PluginCostTotals
+{
+	PluginCostTotals();
+
+	void Add(const PluginCost &cost);
+
+	double AverageWallMs() const
+	{
+		return count ? wall_us / 1000.0 / count : 0.0;
+	}
+	double AverageCpuMs() const
+	{
+		return count ? cpu_us / 1000.0 / count : 0.0;
+	}
+	double MaxWallMs() const
+	{
+		return max_wall_us / 1000.0;
+	}
+	double LastWallMs() const
+	{
+		return last_wall_us / 1000.0;
+	}
+
+	uint64_t count;
+	uint64_t wall_us;
+	uint64_t cpu_us;
+	uint64_t max_wall_us;
+	uint64_t last_wall_us;
+};
+
+struct PluginProfile
+{
+	PluginProfile();
+
+	/**
+	 * Average cost of loading and unloading the plugin once, used to rank
+	 * plugins.
+	 */
+	double GetCostMs() const
+	{
+		return load.AverageWallMs() + unload.AverageWallMs();
+	}
+
+	PluginCostTotals load;
+	PluginCostTotals unload;
+	int64_t mem_bytes;             // runtime memory after the last load
+	std::set<std::string> groups;  // groups the plugin was loaded or unloaded for
+};
+
+/**
+ * Load and unload costs of every plugin the extension has touched, kept in
+ * data/modegroup.profile across map changes and extension reloads.
+ */
+class PluginProfiler
+{
+public:
+	PluginProfiler();
+
+	void RecordLoad(const std::string &plugin, const std::string &group, const PluginCost &cost);
+	void RecordUnload(const std::string &plugin, const std::string &group, const PluginCost &cost);
+
+	/**
+	 * Returns the plugins of a group, or all plugins if group is NULL, most
+	 * expensive first. The group name is compared case-insensitively.
+	 */
+	void GetRanking(const char *group, std::vector<std::pair<std::string, const PluginProfile *>> &ranking) const;
+
+	/**
+	 * Replaces the profiles with the contents of the file. A missing,
+	 * outdated or damaged file leaves them empty.
+	 */
+	bool Load(const char *path);
+
+	/**
+	 * Writes the file if anything was recorded since the last save.
+	 */
+	bool Save(const char *path);
+
+private:
+	std::map<std::string, PluginProfile> m_Plugins;
+	bool m_Dirty;
+};
+
+#endif // _INCLUDE_MODEGROUP_PLUGINPROFILE_H_
@@ -0,0 +1,241 @@
+#include "prefetch.h"
+#include <cstdio>
+
+// sp_file_hdr_t from sourcepawn's smx-headers.h, packed to 24 bytes
+#define SMX_HEADER_SIZE		24
+#define SMX_FILE_MAGIC		0x53504646
+#define SMX_VERSION_MIN		0x0101
+#define SMX_VERSION_MAX		0x01FF
+#define SMX_COMPRESSION_NONE	0
+#define SMX_COMPRESSION_GZ	1
+#define SMX_MAX_IMAGE_SIZE	(256 * 1024 * 1024)
+
+#define PREFETCH_MAX_THREADS	4
+#define PREFETCH_CHUNK_SIZE	(64 * 1024)
+
+static inline unsigned int ReadLE16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline unsigned int ReadLE32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+PluginPrefetcher::PluginPrefetcher() : m_Next(0), m_Finished(0), m_Cancel(false)
+{
+}
+
+PluginPrefetcher::~PluginPrefetcher()
+{
+	Cancel();
+}
+
+void PluginPrefetcher::Start(const std::vector<std::string> &plugins)
+{
+	Cancel();
+
+	m_Paths.resize(plugins.size());
+	m_Errors.assign(plugins.size(), std::string());
+	m_Index.clear();
+
+	for (size_t i = 0; i < plugins.size(); i++)
+	{
+		char path[PLATFORM_MAX_PATH];
+		g_pSM->BuildPath(Path_SM, path, sizeof(path), "plugins/%s", plugins[i].c_str());
+		m_Paths[i] = path;
+		m_Index[plugins[i]] = i;
+	}
+
+	m_Next = 0;
+	m_Finished = 0;
+	m_Cancel = false;
+
+	if (plugins.empty())
+	{
+		return;
+	}
+
+	size_t threads = std::thread::hardware_concurrency();
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+	if (threads > PREFETCH_MAX_THREADS)
+	{
+		threads = PREFETCH_MAX_THREADS;
+	}
+	if (threads > plugins.size())
+	{
+		threads = plugins.size();
+	}
+
+	for (size_t i = 0; i < threads; i++)
+	{
+		m_Threads.push_back(std::thread(&PluginPrefetcher::Worker, this));
+	}
+}
+
+bool PluginPrefetcher::IsDone() const
+{
+	return m_Finished.load(std::memory_order_acquire) >= m_Paths.size();
+}
+
+void PluginPrefetcher::Wait()
+{
+	for (size_t i = 0; i < m_Threads.size(); i++)
+	{
+		m_Threads[i].join();
+	}
+	m_Threads.clear();
+}
+
+void PluginPrefetcher::Cancel()
+{
+	m_Cancel = true;
+	Wait();
+
+	m_Paths.clear();
+	m_Errors.clear();
+	m_Index.clear();
+}
+
+const char *PluginPrefetcher::GetError(const std::string &plugin) const
+{
+	std::unordered_map<std::string, size_t>::const_iterator it = m_Index.find(plugin);
+	if (it == m_Index.end() || m_Errors[it->second].empty())
+	{
+		return NULL;
+	}
+
+	return m_Errors[it->second].c_str();
+}
+
+void PluginPrefetcher::Worker()
+{
+	while (!m_Cancel.load(std::memory_order_relaxed))
+	{
+		size_t index = m_Next.fetch_add(1);
+		if (index >= m_Paths.size())
+		{
+			break;
+		}
+
+		Prefetch(index);
+		m_Finished.fetch_add(1, std::memory_order_release);
+	}
+}
+
+void PluginPrefetcher::Prefetch(size_t index)
+{
+	char error[256];
+
+	FILE *fp = fopen(m_Paths[index].c_str(), "rb");
+	if (!fp)
+	{
+		m_Errors[index] = "file not found";
+		return;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long fileSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	// 整个文件读一遍, 主线程加载时直接命中页缓存
+	std::vector<unsigned char> chunk(PREFETCH_CHUNK_SIZE);
+	unsigned char header[SMX_HEADER_SIZE];
+	size_t headerLen = 0;
+	size_t total = 0;
+	size_t read;
+
+	while ((read = fread(&chunk[0], 1, chunk.size(), fp)) > 0)
+	{
+		if (headerLen < SMX_HEADER_SIZE)
+		{
+			size_t take = SMX_HEADER_SIZE - headerLen;
+			if (take > read)
+			{
+				take = read;
+			}
+			memcpy(header + headerLen, &chunk[0], take);
+			headerLen += take;
+		}
+		total += read;
+
+		if (m_Cancel.load(std::memory_order_relaxed))
+		{
+			break;
+		}
+	}
+
+	bool failed = ferror(fp) != 0;
+	fclose(fp);
+
+	if (failed || fileSize < 0 || total != (size_t)fileSize)
+	{
+		m_Errors[index] = "read error";
+		return;
+	}
+
+	if (!ValidateHeader(header, headerLen, total, error, sizeof(error)))
+	{
+		m_Errors[index] = error;
+	}
+}
+
+bool PluginPrefetcher::ValidateHeader(const unsigned char *data, size_t length, size_t fileSize, char *error, size_t maxlen)
+{
+	if (length < SMX_HEADER_SIZE)
+	{
+		ke::SafeSprintf(error, maxlen, "file too small (%zu bytes)", fileSize);
+		return false;
+	}
+
+	unsigned int magic = ReadLE32(data);
+	unsigned int version = ReadLE16(data + 4);
+	unsigned int compression = data[6];
+	unsigned int disksize = ReadLE32(data + 7);
+	unsigned int imagesize = ReadLE32(data + 11);
+	unsigned int sections = data[15];
+	unsigned int dataoffs = ReadLE32(data + 20);
+
+	if (magic != SMX_FILE_MAGIC)
+	{
+		ke::SafeStrcpy(error, maxlen, "not an .smx file (bad magic)");
+		return false;
+	}
+
+	if (version < SMX_VERSION_MIN || version > SMX_VERSION_MAX)
+	{
+		ke::SafeSprintf(error, maxlen, "unsupported file version %x", version);
+		return false;
+	}
+
+	if (compression != SMX_COMPRESSION_NONE && compression != SMX_COMPRESSION_GZ)
+	{
+		ke::SafeSprintf(error, maxlen, "unknown compression type %u", compression);
+		return false;
+	}
+
+	if (disksize > fileSize)
+	{
+		ke::SafeSprintf(error, maxlen, "file truncated (%zu of %u bytes)", fileSize, disksize);
+		return false;
+	}
+
+	if (imagesize < SMX_HEADER_SIZE || imagesize > SMX_MAX_IMAGE_SIZE
+		|| (compression == SMX_COMPRESSION_NONE && imagesize > fileSize))
+	{
+		ke::SafeSprintf(error, maxlen, "invalid image size %u", imagesize);
+		return false;
+	}
+
+	if (sections == 0 || dataoffs < SMX_HEADER_SIZE || dataoffs > disksize)
+	{
+		ke::SafeStrcpy(error, maxlen, "corrupt section table");
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,66 @@
+#ifndef _INCLUDE_MODEGROUP_PREFETCH_H_
+#define _INCLUDE_MODEGROUP_PREFETCH_H_
+
+/**
+ * @file prefetch.h
+ * @brief Background reading and validation of plugin files.
+ */
+
+#include "smsdk_ext.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * Reads a list of .smx files on worker threads before the main thread loads
+ * them. Every file is read once end to end so it sits in the page cache, and
+ * its header is checked so broken files can be skipped without a failed
+ * plsys->LoadPlugin() call.
+ *
+ * Start(), IsDone(), Wait() and GetError() are only called from the main
+ * thread. Results may only be read once IsDone() returned true.
+ */
+class PluginPrefetcher
+{
+public:
+	PluginPrefetcher();
+	~PluginPrefetcher();
+
+	/**
+	 * Cancels any previous run and starts reading the given plugins, which
+	 * are paths relative to the plugins folder.
+	 */
+	void Start(const std::vector<std::string> &plugins);
+
+	bool IsDone() const;
+	void Wait();
+	void Cancel();
+
+	/**
+	 * Returns why a plugin failed validation, or NULL if it looked fine or
+	 * was not part of this run.
+	 */
+	const char *GetError(const std::string &plugin) const;
+
+	/**
+	 * Checks the header of an .smx image against the size of its file.
+	 */
+	static bool ValidateHeader(const unsigned char *data, size_t length, size_t fileSize, char *error, size_t maxlen);
+
+private:
+	void Worker();
+	void Prefetch(size_t index);
+
+private:
+	std::vector<std::string> m_Paths;
+	std::vector<std::string> m_Errors;
+	std::unordered_map<std::string, size_t> m_Index;
+	std::vector<std::thread> m_Threads;
+	std::atomic<size_t> m_Next;
+	std::atomic<size_t> m_Finished;
+	std::atomic<bool> m_Cancel;
+};
+
+#endif // _INCLUDE_MODEGROUP_PREFETCH_H_
@@ -0,0 +1,320 @@
+#include "switchstats.h"
+#include "cachestream.h"
+#include "configcache.h"
+#include "mappedfile.h"
+#include <cmath>
+
+#define SWITCH_HISTOGRAMS_MAGIC		0x5348474D // "MGHS"
+#define SWITCH_HISTOGRAMS_VERSION	1
+
+/**
+ * Layout of data/modegroup.stats after the header:
+ *   u32 group count
+ *   per group: name, then the total, load and unload histograms as
+ *              u64 count, u64 max, u32 used buckets, (u32 bucket, u64 count) pairs
+ */
+struct SwitchHistogramsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t payload_size;
+	uint64_t payload_hash;
+};
+
+static const char *g_PhaseNames[SwitchStat_Count] =
+{
+	"scan",
+	"unload",
+	"prefetch",
+	"load",
+	"cvars",
+	"commands",
+	"forward",
+};
+
+SwitchStats::SwitchStats() : total_ms(0.0), wall_ms(0.0), loaded(0), unloaded(0), resumed(0), suspended(0), slowest_count(0)
+{
+	for (int i = 0; i < SwitchStat_Count; i++)
+	{
+		phase_ms[i] = 0.0;
+	}
+}
+
+void SwitchStats::AddPluginLoad(const std::string &plugin, double ms)
+{
+	size_t pos = slowest_count;
+	while (pos > 0 && slowest[pos - 1].ms < ms)
+	{
+		pos--;
+	}
+	if (pos >= SWITCH_STATS_SLOWEST)
+	{
+		return;
+	}
+
+	// 后面的往后挪一位, 挤掉最快的那个
+	size_t last = slowest_count < SWITCH_STATS_SLOWEST ? slowest_count : SWITCH_STATS_SLOWEST - 1;
+	for (size_t i = last; i > pos; i--)
+	{
+		slowest[i] = slowest[i - 1];
+	}
+	slowest[pos].plugin = plugin;
+	slowest[pos].ms = ms;
+
+	if (slowest_count < SWITCH_STATS_SLOWEST)
+	{
+		slowest_count++;
+	}
+}
+
+const char *SwitchStats::GetPhaseName(SwitchStatPhase phase)
+{
+	if (phase < 0 || phase >= SwitchStat_Count)
+	{
+		return "unknown";
+	}
+	return g_PhaseNames[phase];
+}
+
+SwitchStatsHistory::SwitchStatsHistory() : m_Next(0), m_Count(0)
+{
+}
+
+void SwitchStatsHistory::Push(const SwitchStats &stats)
+{
+	m_Stats[m_Next] = stats;
+	m_Next = (m_Next + 1) % SWITCH_STATS_HISTORY;
+	if (m_Count < SWITCH_STATS_HISTORY)
+	{
+		m_Count++;
+	}
+}
+
+const SwitchStats &SwitchStatsHistory::Get(size_t index) const
+{
+	return m_Stats[(m_Next + SWITCH_STATS_HISTORY - 1 - index) % SWITCH_STATS_HISTORY];
+}
+
+LatencyHistogram::LatencyHistogram() : m_Count(0), m_Max(0)
+{
+	memset(m_Buckets, 0, sizeof(m_Buckets));
+}
+
+size_t LatencyHistogram::GetBucket(uint64_t us)
+{
+	if (us < LATENCY_SUB_BUCKETS)
+	{
+		return (size_t)us;
+	}
+
+	int exponent = 0;
+	for (uint64_t v = us >> 1; v; v >>= 1)
+	{
+		exponent++;
+	}
+	if (exponent > LATENCY_MAX_EXPONENT)
+	{
+		return LATENCY_BUCKETS - 1;
+	}
+
+	// 最高位后面的 LATENCY_SUB_BUCKET_BITS 位决定区间里的哪一格
+	size_t sub = (size_t)(us >> (exponent - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+	return (size_t)(exponent - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::GetBucketMax(size_t bucket)
+{
+	if (bucket < LATENCY_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+
+	int exponent = (int)(bucket / LATENCY_SUB_BUCKETS) + LATENCY_SUB_BUCKET_BITS - 1;
+	uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+	uint64_t width = 1ULL << (exponent - LATENCY_SUB_BUCKET_BITS);
+	return ((LATENCY_SUB_BUCKETS + sub) << (exponent - LATENCY_SUB_BUCKET_BITS)) + width - 1;
+}
+
+void LatencyHistogram::Record(double ms)
+{
+	uint64_t us = ms > 0.0 ? (uint64_t)(ms * 1000.0 + 0.5) : 0;
+	m_Buckets[GetBucket(us)]++;
+	m_Count++;
+	if (us > m_Max)
+	{
+		m_Max = us;
+	}
+}
+
+double LatencyHistogram::Percentile(double percent) const
+{
+	if (m_Count == 0)
+	{
+		return 0.0;
+	}
+
+	uint64_t rank = (uint64_t)ceil(percent / 100.0 * (double)m_Count);
+	if (rank < 1)
+	{
+		rank = 1;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		seen += m_Buckets[i];
+		if (seen >= rank)
+		{
+			uint64_t value = GetBucketMax(i);
+			return (value < m_Max ? value : m_Max) / 1000.0;
+		}
+	}
+
+	return Max();
+}
+
+void LatencyHistogram::Write(CacheWriter &w) const
+{
+	w.U64(m_Count);
+	w.U64(m_Max);
+
+	// 大部分格子是空的, 只写有数据的
+	uint32_t used = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		if (m_Buckets[i])
+		{
+			used++;
+		}
+	}
+
+	w.U32(used);
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		if (m_Buckets[i])
+		{
+			w.U32((uint32_t)i);
+			w.U64(m_Buckets[i]);
+		}
+	}
+}
+
+void LatencyHistogram::Read(CacheReader &r)
+{
+	*this = LatencyHistogram();
+	m_Count = r.U64();
+	m_Max = r.U64();
+
+	uint32_t used = r.U32();
+	for (uint32_t i = 0; i < used && !r.Failed(); i++)
+	{
+		uint32_t bucket = r.U32();
+		uint64_t count = r.U64();
+		if (bucket >= LATENCY_BUCKETS)
+		{
+			r.Fail();
+			return;
+		}
+		m_Buckets[bucket] = count;
+	}
+}
+
+SwitchHistograms::SwitchHistograms() : m_Dirty(false)
+{
+}
+
+void SwitchHistograms::RecordSwitch(const std::string &group, double ms)
+{
+	m_Groups[group].total.Record(ms);
+	m_Dirty = true;
+}
+
+void SwitchHistograms::RecordLoad(const std::string &group, double ms)
+{
+	m_Groups[group].load.Record(ms);
+	m_Dirty = true;
+}
+
+void SwitchHistograms::RecordUnload(const std::string &group, double ms)
+{
+	m_Groups[group].unload.Record(ms);
+	m_Dirty = true;
+}
+
+bool SwitchHistograms::Load(const char *path)
+{
+	m_Groups.clear();
+	m_Dirty = false;
+
+	MappedFile file;
+	if (!file.Open(path) || file.GetSize() < sizeof(SwitchHistogramsHeader))
+	{
+		return false;
+	}
+
+	SwitchHistogramsHeader header;
+	memcpy(&header, file.GetData(), sizeof(header));
+
+	const char *payload = file.GetData() + sizeof(header);
+	size_t payloadSize = file.GetSize() - sizeof(header);
+
+	if (header.magic != SWITCH_HISTOGRAMS_MAGIC
+		|| header.version != SWITCH_HISTOGRAMS_VERSION
+		|| header.payload_size != payloadSize
+		|| header.payload_hash != ConfigCache::Hash(payload, payloadSize))
+	{
+		return false;
+	}
+
+	CacheReader r(payload, payloadSize);
+	uint32_t count = r.U32();
+	std::string name;
+	for (uint32_t i = 0; i < count && !r.Failed(); i++)
+	{
+		r.Str(name);
+		GroupLatency &latency = m_Groups[name];
+		latency.total.Read(r);
+		latency.load.Read(r);
+		latency.unload.Read(r);
+	}
+
+	if (r.Failed() || !r.AtEnd())
+	{
+		m_Groups.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool SwitchHistograms::Save(const char *path)
+{
+	if (!m_Dirty)
+	{
+		return true;
+	}
+
+	CacheWriter w;
+	w.U32((uint32_t)m_Groups.size());
+	for (std::map<std::string, GroupLatency>::const_iterator it = m_Groups.begin(); it != m_Groups.end(); ++it)
+	{
+		w.Str(it->first);
+		it->second.total.Write(w);
+		it->second.load.Write(w);
+		it->second.unload.Write(w);
+	}
+
+	SwitchHistogramsHeader header;
+	header.magic = SWITCH_HISTOGRAMS_MAGIC;
+	header.version = SWITCH_HISTOGRAMS_VERSION;
+	header.payload_size = w.Data().size();
+	header.payload_hash = ConfigCache::Hash(w.Data().data(), w.Data().size());
+
+	if (!WriteCacheFile(path, &header, sizeof(header), w.Data()))
+	{
+		return false;
+	}
+
+	m_Dirty = false;
+	return true;
+}
@@ -0,0 +1,209 @@
+#ifndef _INCLUDE_MODEGROUP_SWITCHSTATS_H_
+#define _INCLUDE_MODEGROUP_SWITCHSTATS_H_
+
+/**
+ * @file switchstats.h
+ * @brief Timings and latency histograms of mode group switches.
+ */
+
+#include "smsdk_ext.h"
+#include <string>
+#include <map>
+#include <chrono>
+
+#define SWITCH_STATS_HISTORY	16
+#define SWITCH_STATS_SLOWEST	5
+
+// 每个 2 的幂区间分 8 格, 误差不超过 12.5%
+#define LATENCY_SUB_BUCKET_BITS	3
+#define LATENCY_SUB_BUCKETS		(1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_EXPONENT	36 // 2^36 us, about 19 hours
+#define LATENCY_BUCKETS			((LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 2) * LATENCY_SUB_BUCKETS)
+
+class CacheWriter;
+class CacheReader;
+
+/**
+ * Parts of a switch that are timed separately. The order and values are
+ * shared with ModeGroupPhase in modegroup.inc.
+ */
+enum SwitchStatPhase
+{
+	SwitchStat_Scan = 0,  // resolving the plan, including plugin directory scans
+	SwitchStat_Unload,    // leaving plugins and the group's unload_plugins
+	SwitchStat_Prefetch,  // waiting for the prefetch worker threads
+	SwitchStat_Load,
+	SwitchStat_Cvars,
+	SwitchStat_Commands,
+	SwitchStat_Forward,   // OnModeGroupChanged
+	SwitchStat_Count,
+};
+
+struct PluginTiming
+{
+	std::string plugin;
+	double ms;
+};
+
+/**
+ * Timings of one finished switch. Times are in milliseconds and only count
+ * work done by the switch, so an incremental switch spread over many frames
+ * reports the same busy time as a synchronous one; wall_ms covers the whole
+ * span from the request to the forward.
+ */
+struct SwitchStats
+{
+	SwitchStats();
+
+	std::string from;
+	std::string to;
+	double total_ms;
+	double wall_ms;
+	double phase_ms[SwitchStat_Count];
+	size_t loaded;
+	size_t unloaded;
+	size_t resumed;   // suspended plugins resumed instead of loaded
+	size_t suspended; // leaving plugins paused instead of unloaded
+	PluginTiming slowest[SWITCH_STATS_SLOWEST]; // slowest plugin loads, slowest first
+	size_t slowest_count;
+
+	/**
+	 * Adds a plugin load to the slowest list if it belongs there.
+	 */
+	void AddPluginLoad(const std::string &plugin, double ms);
+
+	static const char *GetPhaseName(SwitchStatPhase phase);
+};
+
+/**
+ * Ring buffer of the last SWITCH_STATS_HISTORY switches.
+ */
+class SwitchStatsHistory
+{
+public:
+	SwitchStatsHistory();
+
+	void Push(const SwitchStats &stats);
+
+	size_t Count() const
+	{
+		return m_Count;
+	}
+
+	/**
+	 * Returns a recorded switch, 0 being the most recent one.
+	 */
+	const SwitchStats &Get(size_t index) const;
+
+private:
+	SwitchStats m_Stats[SWITCH_STATS_HISTORY];
+	size_t m_Next;
+	size_t m_Count;
+};
+
+/**
+ * Log-bucketed histogram of durations in the style of HdrHistogram. Values
+ * are stored in microseconds; every power of two is split into
+ * LATENCY_SUB_BUCKETS buckets, so percentiles are accurate to 12.5% at any
+ * scale with a fixed amount of memory.
+ */
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void Record(double ms);
+
+	uint64_t Count() const
+	{
+		return m_Count;
+	}
+	double Max() const
+	{
+		return m_Max / 1000.0;
+	}
+
+	/**
+	 * Returns the highest value, in milliseconds, that falls into the same
+	 * bucket as the given percentile.
+	 */
+	double Percentile(double percent) const;
+
+	void Write(CacheWriter &w) const;
+	void Read(CacheReader &r);
+
+private:
+	static size_t GetBucket(uint64_t us);
+	static uint64_t GetBucketMax(size_t bucket);
+
+private:
+	uint64_t m_Buckets[LATENCY_BUCKETS];
+	uint64_t m_Count;
+	uint64_t m_Max;
+};
+
+/**
+ * Latency distributions of switches to one group.
+ */
+struct GroupLatency
+{
+	LatencyHistogram total;  // whole switches, busy time
+	LatencyHistogram load;   // single plugin loads
+	LatencyHistogram unload; // single plugin unloads
+};
+
+/**
+ * Per-group histograms, kept in data/modegroup.stats across map changes and
+ * extension reloads. Samples are filed under the group being switched to.
+ */
+class SwitchHistograms
+{
+public:
+	SwitchHistograms();
+
+	void RecordSwitch(const std::string &group, double ms);
+	void RecordLoad(const std::string &group, double ms);
+	void RecordUnload(const std::string &group, double ms);
+
+	const std::map<std::string, GroupLatency> &GetGroups() const
+	{
+		return m_Groups;
+	}
+
+	/**
+	 * Replaces the histograms with the contents of the state file. A missing,
+	 * outdated or damaged file leaves them empty.
+	 */
+	bool Load(const char *path);
+
+	/**
+	 * Writes the state file if anything was recorded since the last save.
+	 */
+	bool Save(const char *path);
+
+private:
+	std::map<std::string, GroupLatency> m_Groups;
+	bool m_Dirty;
+};
+
+/**
+ * Monotonic timer for a single measurement.
+ */
+class StopWatch
+{
+public:
+	StopWatch() : m_Start(std::chrono::steady_clock::now())
+	{
+	}
+
+	double ElapsedMs() const
+	{
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_Start;
+		return elapsed.count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point m_Start;
+};
+
+#endif // _INCLUDE_MODEGROUP_SWITCHSTATS_H_